@@ -0,0 +1,735 @@
+// Batched file operations definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "batch.h"
+#include "walker.h"
+#include "cache.h"
+
+
+/**
+ * @brief @struct type for an io_uring instance, mapped by hand as the
+ * library is not required.
+*/
+typedef struct ring
+{
+	int fd;
+	// Mappings shared with the kernel, released if the instance breaks
+	void *rings;
+	size_t rings_size;
+	size_t sqes_size;
+	// Submission queue
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	struct io_uring_sqe *sqes;
+	// Completion queue
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+	// Operations supported by the kernel
+	bool supported[IORING_OP_LAST];
+} Ring;
+
+/**
+ * The instance is set up on first use, and kept for the next batches.
+ * Builtins of a pipeline run on their own threads, so a batch holds the
+ * lock for as long as it uses the instance.
+*/
+static Ring ring = {.fd = -1};
+static bool ring_failed = false;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Results of the operations not run yet, and of those left in the kernel
+#define PENDING 1
+#define SUBMITTED 2
+
+
+// Set the instance up, returning false if io_uring cannot be used
+static bool ring_init(void)
+{
+	if (ring.fd != -1)
+	{
+		return true;
+	}
+	if (ring_failed)
+	{
+		return false;
+	}
+	ring_failed = true;
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	int fd = syscall(__NR_io_uring_setup, BATCH_DEPTH, &params);
+	if (fd == -1)
+	{
+		return false;
+	}
+
+	// Both rings share a single mapping on the kernels supporting batches
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+	{
+		close(fd);
+		return false;
+	}
+	size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	size_t size = sq_size > cq_size ? sq_size : cq_size;
+	size_t sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	char *rings = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	struct io_uring_sqe *sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (rings == MAP_FAILED || sqes == MAP_FAILED)
+	{
+		if (rings != MAP_FAILED)
+		{
+			munmap(rings, size);
+		}
+		if (sqes != MAP_FAILED)
+		{
+			munmap(sqes, sqes_size);
+		}
+		close(fd);
+		return false;
+	}
+
+	ring.rings = rings;
+	ring.rings_size = size;
+	ring.sqes_size = sqes_size;
+	ring.sq_head = (unsigned *) (rings + params.sq_off.head);
+	ring.sq_tail = (unsigned *) (rings + params.sq_off.tail);
+	ring.sq_mask = (unsigned *) (rings + params.sq_off.ring_mask);
+	ring.sq_array = (unsigned *) (rings + params.sq_off.array);
+	ring.sqes = sqes;
+	ring.cq_head = (unsigned *) (rings + params.cq_off.head);
+	ring.cq_tail = (unsigned *) (rings + params.cq_off.tail);
+	ring.cq_mask = (unsigned *) (rings + params.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *) (rings + params.cq_off.cqes);
+
+	// Ask which operations the kernel knows
+	size_t probe_size = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, probe_size);
+	if (probe != NULL && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0)
+	{
+		for (int i = 0; i < probe->ops_len && i < IORING_OP_LAST; i++)
+		{
+			ring.supported[i] = probe->ops[i].flags & IO_URING_OP_SUPPORTED;
+		}
+	}
+	free(probe);
+
+	ring.fd = fd;
+	ring_failed = false;
+	return true;
+}
+
+
+// Release an instance whose completions can no longer be trusted
+static void ring_close(void)
+{
+	munmap(ring.sqes, ring.sqes_size);
+	munmap(ring.rings, ring.rings_size);
+	close(ring.fd);
+	ring.fd = -1;
+	ring_failed = true;
+}
+
+
+// Fill the next submission entry with the operation on file @p index
+static void prepare(Batch_op op, int dirfd, char **paths, int index, mode_t mode, int fd)
+{
+	unsigned tail = *ring.sq_tail;
+	unsigned slot = tail & *ring.sq_mask;
+	struct io_uring_sqe *sqe = &ring.sqes[slot];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->user_data = index;
+	sqe->fd = dirfd;
+	sqe->addr = (unsigned long) paths[index];
+
+	switch (op)
+	{
+		case BATCH_CREATE:
+			// A second pass closes the files created, 'fd' being set
+			if (fd != -1)
+			{
+				sqe->opcode = IORING_OP_CLOSE;
+				sqe->fd = fd;
+				sqe->addr = 0;
+				break;
+			}
+			sqe->opcode = IORING_OP_OPENAT;
+			sqe->open_flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+			sqe->len = mode;
+			break;
+		case BATCH_MKDIR:
+			sqe->opcode = IORING_OP_MKDIRAT;
+			sqe->len = mode;
+			break;
+		case BATCH_UNLINK:
+			sqe->opcode = IORING_OP_UNLINKAT;
+			break;
+		case BATCH_RMDIR:
+			sqe->opcode = IORING_OP_UNLINKAT;
+			sqe->unlink_flags = AT_REMOVEDIR;
+			break;
+	}
+
+	ring.sq_array[slot] = slot;
+	// The entry must be visible to the kernel before the new tail
+	atomic_store_explicit((_Atomic unsigned *) ring.sq_tail, tail + 1, memory_order_release);
+}
+
+
+// Gather the completions available, returning their number
+static int reap(int *results, int *fds, int *close_fds)
+{
+	int reaped = 0;
+	unsigned head = *ring.cq_head;
+	unsigned tail = atomic_load_explicit((_Atomic unsigned *) ring.cq_tail, memory_order_acquire);
+	while (head != tail)
+	{
+		struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+		int index = (int) cqe->user_data;
+		if (close_fds != NULL)
+		{
+			// The descriptor is released, even when close() reports an error
+			close_fds[index] = -1;
+			if (cqe->res < 0)
+			{
+				results[index] = cqe->res;
+			}
+		}
+		else
+		{
+			results[index] = cqe->res < 0 ? cqe->res : 0;
+			if (fds != NULL)
+			{
+				fds[index] = cqe->res;
+			}
+		}
+		head++;
+		reaped++;
+	}
+	atomic_store_explicit((_Atomic unsigned *) ring.cq_head, head, memory_order_release);
+	return reaped;
+}
+
+
+/**
+ * Take back the entries the kernel has not consumed, and wait for those
+ * it has. The instance is released if some of them cannot be waited for,
+ * their outcome being unknown.
+*/
+static void abandon(int *results, int *fds, int *close_fds, int inflight)
+{
+	unsigned head = atomic_load_explicit((_Atomic unsigned *) ring.sq_head, memory_order_acquire);
+	for (unsigned entry = head; entry != *ring.sq_tail; entry++)
+	{
+		struct io_uring_sqe *sqe = &ring.sqes[ring.sq_array[entry & *ring.sq_mask]];
+		int index = (int) sqe->user_data;
+		if (close_fds != NULL)
+		{
+			close_fds[index] = sqe->fd;
+		}
+		else
+		{
+			results[index] = PENDING;
+		}
+		inflight--;
+	}
+	// Without a polling thread, only io_uring_enter() consumes entries
+	atomic_store_explicit((_Atomic unsigned *) ring.sq_tail, head, memory_order_release);
+
+	while (inflight > 0)
+	{
+		int waited = syscall(__NR_io_uring_enter, ring.fd, 0, inflight, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (waited == -1 && errno != EINTR)
+		{
+			ring_close();
+			return;
+		}
+		inflight -= reap(results, fds, close_fds);
+	}
+}
+
+
+/**
+ * Submit the operations on all the files, a queue depth at a time, and
+ * gather their results. When @p fds is given, it receives the value of
+ * each completion, the results only getting the errors. When
+ * @p close_fds is given, the descriptors it holds are closed instead,
+ * and set to -1 once they are.
+ * 
+ * On failure, the operations not run are left PENDING, and those whose
+ * outcome is unknown SUBMITTED; their descriptors are left below -1.
+*/
+static bool submit_all(Batch_op op, int dirfd, char **paths, int count, mode_t mode, int *results, int *fds, int *close_fds)
+{
+	int next = 0, inflight = 0;
+	while (true)
+	{
+		// Queue as many operations as there are free slots
+		while (next < count && inflight < BATCH_DEPTH)
+		{
+			if (close_fds != NULL)
+			{
+				if (close_fds[next] < 0)
+				{
+					// Nothing to close: the file was not created
+					next++;
+					continue;
+				}
+				prepare(op, dirfd, paths, next, mode, close_fds[next]);
+				close_fds[next] = -SUBMITTED;
+			}
+			else
+			{
+				prepare(op, dirfd, paths, next, mode, -1);
+				results[next] = SUBMITTED;
+			}
+			next++;
+			inflight++;
+		}
+		if (inflight == 0)
+		{
+			return true;
+		}
+
+		// Entries left over by an interrupted call are submitted as well
+		unsigned head_sq = atomic_load_explicit((_Atomic unsigned *) ring.sq_head, memory_order_acquire);
+		int submitted = syscall(__NR_io_uring_enter, ring.fd, *ring.sq_tail - head_sq, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (submitted == -1 && errno != EINTR)
+		{
+			abandon(results, fds, close_fds, inflight);
+			return false;
+		}
+		inflight -= reap(results, fds, close_fds);
+	}
+}
+
+
+/**
+ * @brief @struct type shared by the threads of the fallback.
+*/
+typedef struct job
+{
+	Batch_op op;
+	int dirfd;
+	char **paths;
+	int count;
+	mode_t mode;
+	int *results;
+	atomic_int next;
+} Job;
+
+
+// Run a single operation with a blocking system call
+static int run_one(Batch_op op, int dirfd, const char *path, mode_t mode)
+{
+	int result = 0;
+	switch (op)
+	{
+		case BATCH_CREATE:
+			result = openat(dirfd, path, O_WRONLY | O_CREAT | O_CLOEXEC, mode);
+			if (result != -1)
+			{
+				close(result);
+			}
+			break;
+		case BATCH_MKDIR:
+			result = mkdirat(dirfd, path, mode);
+			break;
+		case BATCH_UNLINK:
+			result = unlinkat(dirfd, path, 0);
+			break;
+		case BATCH_RMDIR:
+			result = unlinkat(dirfd, path, AT_REMOVEDIR);
+			break;
+	}
+	return result == -1 ? -errno : 0;
+}
+
+
+// Thread of the fallback: take the next pending file until none is left
+static void *run_jobs(void *argument)
+{
+	Job *job = argument;
+	int index;
+	while ((index = job->next++) < job->count)
+	{
+		if (job->results[index] == PENDING)
+		{
+			job->results[index] = run_one(job->op, job->dirfd, job->paths[index], job->mode);
+		}
+	}
+	return NULL;
+}
+
+
+// Run the pending operations on a pool of threads
+static void run_threads(Batch_op op, int dirfd, char **paths, int count, mode_t mode, int *results)
+{
+	Job job = {op, dirfd, paths, count, mode, results, 0};
+
+	int threads = default_threads();
+	if (threads > count / BATCH_MIN)
+	{
+		threads = count / BATCH_MIN;
+	}
+	pthread_t *ids = calloc(threads, sizeof(pthread_t));
+	int started = 0;
+	for (int i = 1; ids != NULL && i < threads; i++)
+	{
+		if (pthread_create(&ids[started], NULL, run_jobs, &job) == 0)
+		{
+			started++;
+		}
+	}
+	// The calling thread takes its share as well
+	run_jobs(&job);
+	for (int i = 0; i < started; i++)
+	{
+		pthread_join(ids[i], NULL);
+	}
+	free(ids);
+}
+
+
+// Submit the operations of a wave to the ring, returning false if it cannot be used
+static bool run_ring(Batch_op op, int dirfd, char **paths, int count, mode_t mode, int *results)
+{
+	int opcode = op == BATCH_CREATE ? IORING_OP_OPENAT : op == BATCH_MKDIR ? IORING_OP_MKDIRAT : IORING_OP_UNLINKAT;
+	if (!ring_init() || !ring.supported[opcode] || (op == BATCH_CREATE && !ring.supported[IORING_OP_CLOSE]))
+	{
+		return false;
+	}
+	if (op != BATCH_CREATE)
+	{
+		submit_all(op, dirfd, paths, count, mode, results, NULL, NULL);
+		return true;
+	}
+
+	// Create all the files, then close all of those that were created
+	int *fds = malloc(count * sizeof(int));
+	if (fds == NULL)
+	{
+		return false;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		fds[i] = -1;
+	}
+	bool created = submit_all(op, dirfd, paths, count, mode, results, fds, NULL);
+	if (!created || !submit_all(op, dirfd, paths, count, mode, results, NULL, fds))
+	{
+		// Close by hand what the ring did not; the others are lost with it
+		for (int i = 0; i < count; i++)
+		{
+			if (fds[i] >= 0)
+			{
+				close(fds[i]);
+			}
+		}
+	}
+	free(fds);
+	return true;
+}
+
+
+// Run a wave of operations on unrelated files, in any order
+static void run_wave(Batch_op op, int dirfd, char **paths, int count, mode_t mode, int *results)
+{
+	for (int i = 0; i < count; i++)
+	{
+		results[i] = PENDING;
+	}
+	if (count < BATCH_MIN)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			results[i] = run_one(op, dirfd, paths[i], mode);
+		}
+		return;
+	}
+
+	pthread_mutex_lock(&ring_lock);
+	bool uring = run_ring(op, dirfd, paths, count, mode, results);
+	pthread_mutex_unlock(&ring_lock);
+
+	// Only the operations the ring did not run are left to the threads
+	bool pending = !uring;
+	for (int i = 0; i < count; i++)
+	{
+		if (results[i] == SUBMITTED)
+		{
+			results[i] = -ECANCELED;
+		}
+		pending |= results[i] == PENDING;
+	}
+	if (pending)
+	{
+		run_threads(op, dirfd, paths, count, mode, results);
+	}
+}
+
+
+/**
+ * @brief @struct type for a path met among the operands: the last wave
+ * of an operand naming it, and of an operand below it, or -1.
+*/
+typedef struct node
+{
+	const char *key;
+	size_t length;
+	int self;
+	int below;
+} Node;
+
+
+/**
+ * Copy @p path to @p out without its empty and "." components, so that
+ * "a//b/./c" and "a/b/c" compare equal. Returns the length written, and
+ * the number of components in @p components .
+*/
+static size_t normalize(const char *path, char *out, int *components, bool *parent)
+{
+	size_t length = 0;
+	*components = 0;
+	if (path[0] == '/')
+	{
+		out[length++] = '/';
+	}
+	while (*path != '\0')
+	{
+		while (*path == '/')
+		{
+			path++;
+		}
+		size_t size = strcspn(path, "/");
+		if (size == 0 || (size == 1 && path[0] == '.'))
+		{
+			path += size;
+			continue;
+		}
+		if (size == 2 && path[0] == '.' && path[1] == '.')
+		{
+			*parent = true;
+		}
+		if (length > 0 && out[length - 1] != '/')
+		{
+			out[length++] = '/';
+		}
+		memcpy(out + length, path, size);
+		length += size;
+		path += size;
+		(*components)++;
+	}
+	out[length] = '\0';
+	return length;
+}
+
+
+// Find the node of a path, or the empty slot where it belongs
+static Node *lookup(Node *table, size_t mask, const char *key, size_t length)
+{
+	size_t slot = hash_bytes(key, length, CACHE_SEED) & mask;
+	while (table[slot].key != NULL && (table[slot].length != length || memcmp(table[slot].key, key, length)))
+	{
+		slot = (slot + 1) & mask;
+	}
+	return &table[slot];
+}
+
+
+/**
+ * Spread the operands over waves, run one after the other, so that an
+ * operand naming an earlier one, or a file above or below it, runs after
+ * it as it would from left to right. Operands using ".." cannot be
+ * compared by name and are ordered with all of the others. Returns the
+ * number of waves.
+*/
+static int plan_waves(char **paths, int count, int *waves)
+{
+	size_t total = 0;
+	for (int i = 0; i < count; i++)
+	{
+		total += strlen(paths[i]) + 2;
+	}
+	char *names = malloc(total);
+	size_t *offsets = malloc(count * sizeof(size_t));
+	int *depths = malloc(count * sizeof(int));
+	bool *parents = calloc(count, sizeof(bool));
+	Node *table = NULL;
+	size_t capacity = 16;
+	if (names != NULL && offsets != NULL && depths != NULL && parents != NULL)
+	{
+		size_t offset = 0, nodes = 0;
+		for (int i = 0; i < count; i++)
+		{
+			offsets[i] = offset;
+			offset += normalize(paths[i], names + offset, &depths[i], &parents[i]) + 1;
+			nodes += depths[i];
+		}
+		while (capacity < nodes * 2)
+		{
+			capacity *= 2;
+		}
+		table = calloc(capacity, sizeof(Node));
+	}
+	if (table == NULL)
+	{
+		// Without memory, keep the operands in turn
+		free(names);
+		free(offsets);
+		free(depths);
+		free(parents);
+		for (int i = 0; i < count; i++)
+		{
+			waves[i] = i;
+		}
+		return count;
+	}
+
+	size_t mask = capacity - 1;
+	int last = 0, barrier = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const char *name = names + offsets[i];
+		size_t length = strlen(name);
+		int wave = barrier;
+		if (parents[i])
+		{
+			wave = barrier = last + 1;
+		}
+
+		// Wait for the operands naming this file or one of its parents
+		for (size_t end = 1; end <= length; end++)
+		{
+			if (end == length || name[end] == '/')
+			{
+				Node *node = lookup(table, mask, name, end);
+				if (node->key != NULL && node->self + 1 > wave)
+				{
+					wave = node->self + 1;
+				}
+				if (end == length && node->key != NULL && node->below + 1 > wave)
+				{
+					wave = node->below + 1;
+				}
+			}
+		}
+		// And record it on the way down for the next ones
+		for (size_t end = 1; end <= length; end++)
+		{
+			if (end == length || name[end] == '/')
+			{
+				Node *node = lookup(table, mask, name, end);
+				if (node->key == NULL)
+				{
+					*node = (Node) {name, end, -1, -1};
+				}
+				if (end == length)
+				{
+					node->self = wave > node->self ? wave : node->self;
+				}
+				else
+				{
+					node->below = wave > node->below ? wave : node->below;
+				}
+			}
+		}
+		waves[i] = wave;
+		if (parents[i])
+		{
+			barrier = wave + 1;
+		}
+		last = wave > last ? wave : last;
+	}
+
+	free(table);
+	free(names);
+	free(offsets);
+	free(depths);
+	free(parents);
+	return last + 1;
+}
+
+
+bool run_batch(Batch_op op, int dirfd, char **paths, int count, mode_t mode, int *results)
+{
+	int *waves = count >= BATCH_MIN ? malloc(count * sizeof(int)) : NULL;
+	int wave_count = waves != NULL ? plan_waves(paths, count, waves) : 1;
+
+	if (waves == NULL && count >= BATCH_MIN)
+	{
+		// Without memory, keep the operands in turn
+		for (int i = 0; i < count; i++)
+		{
+			results[i] = run_one(op, dirfd, paths[i], mode);
+		}
+	}
+	else if (wave_count == 1)
+	{
+		run_wave(op, dirfd, paths, count, mode, results);
+	}
+	else
+	{
+		// Gather each wave apart, the operands keeping their order within it
+		char **wave_paths = malloc(count * sizeof(char *));
+		int *wave_results = malloc(count * sizeof(int));
+		int *indices = malloc(count * sizeof(int));
+		for (int wave = 0; wave < wave_count; wave++)
+		{
+			int size = 0;
+			for (int i = 0; i < count; i++)
+			{
+				if (waves[i] != wave)
+				{
+					continue;
+				}
+				if (wave_paths == NULL || wave_results == NULL || indices == NULL)
+				{
+					results[i] = run_one(op, dirfd, paths[i], mode);
+					continue;
+				}
+				wave_paths[size] = paths[i];
+				indices[size++] = i;
+			}
+			if (size > 0)
+			{
+				run_wave(op, dirfd, wave_paths, size, mode, wave_results);
+				for (int i = 0; i < size; i++)
+				{
+					results[indices[i]] = wave_results[i];
+				}
+			}
+		}
+		free(wave_paths);
+		free(wave_results);
+		free(indices);
+	}
+	free(waves);
+
+	for (int i = 0; i < count; i++)
+	{
+		if (results[i] != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
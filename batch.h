@@ -0,0 +1,56 @@
+/**
+ * Batched file operations declarations
+ * Operations on many files are submitted together through io_uring,
+ * or spread over a pool of threads when io_uring is not available.
+*/
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Number of operations in flight at once in the io_uring queue
+#define BATCH_DEPTH 256
+// Below this number of files, the operations are simply run in turn
+#define BATCH_MIN 4
+
+/**
+ * @brief Operations that can be run in batch.
+*/
+typedef enum batch_op
+{
+	BATCH_CREATE,
+	BATCH_MKDIR,
+	BATCH_UNLINK,
+	BATCH_RMDIR,
+} Batch_op;
+
+
+/**
+ * bool run_batch(Batch_op op, int dirfd, char **paths, int count, mode_t mode, int *results)
+ * @brief Run the same operation on many files.
+ * 
+ * @param[in] op		Operation to run.
+ * @param[in] dirfd		Directory the paths are relative to.
+ * @param[in] paths		Paths of the files.
+ * @param[in] count		Number of files.
+ * @param[in] mode		Permissions of the files or folders created.
+ * @param[out] results	Outcome of each operation: 0 or a negated errno.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true if every operation succeeded.
+ * 						false if not.
+ * 
+ * The function run_batch() runs @p op on the @p count files of
+ * @p paths . An operand naming an earlier one, or a file above or below
+ * it, waits for it as it would from left to right; the unrelated
+ * operands are submitted together to an io_uring instance, kept open for
+ * the next batches, and their completions are reaped in any order. When
+ * io_uring or one of the operations is not supported by the kernel, the
+ * operations are shared between threads instead, and when a submission
+ * fails the threads only run the operations it left undone. Files created
+ * by BATCH_CREATE are not truncated if they already exist.
+*/
+bool run_batch(Batch_op op, int dirfd, char **paths, int count, mode_t mode, int *results);
+
+
+#endif // BATCH_H
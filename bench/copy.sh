@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# Measure 'cp -r' with one thread against several threads.
+#
+# Usage: bench/copy.sh [directories] [files] [KiB] [threads] [shell]
+#
+# A tree of the given number of directories (64 by default), each
+# holding the given number of files (64) of the given size (16 KiB),
+# is created in a temporary directory of $TMPDIR, then copied by the
+# shell (./cli) with -j 1 and with -j threads (one per processor). The
+# best of 3 rounds is displayed for each, the page cache being warm.
+
+directories=${1:-64}
+files=${2:-64}
+size=${3:-16}
+threads=${4:-$(nproc)}
+shell=$(realpath "${5:-./cli}")
+
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+head -c "$((size * 1024))" /dev/urandom > "$directory/file"
+d=0
+while [ "$d" -lt "$directories" ]
+do
+	mkdir -p "$directory/tree/$d"
+	f=0
+	while [ "$f" -lt "$files" ]
+	do
+		cp "$directory/file" "$directory/tree/$d/$f"
+		f=$((f + 1))
+	done
+	d=$((d + 1))
+done
+echo "$directories directories of $files files of $size KiB"
+
+for count in 1 "$threads"
+do
+	round=0
+	while [ "$round" -lt 3 ]
+	do
+		rm -rf "$directory/copy"
+		echo "time cp -r -j $count tree copy" > "$directory/script"
+		(cd "$directory" && "$shell" -f script 2>&1 >/dev/null)
+		round=$((round + 1))
+	done | awk -v count="$count" '
+		$1 == "real" && (best == "" || $2 < best) { best = $2 }
+		END { printf "-j %d\t%.3f s\n", count, best }'
+done
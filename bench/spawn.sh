@@ -0,0 +1,39 @@
+#!/bin/sh
+#
+# Measure the latency of a program launched by the shell, from its
+# spawn to its exit, as reported by --stats for './' programs.
+#
+# Usage: bench/spawn.sh [launches] [shell...]
+#
+# Each shell, ./cli by default, runs a copy of true(1) the number of
+# times given (1000 by default) from a script, for 5 rounds. The best
+# round is displayed, in microseconds per launch. Several shells can be
+# given to compare them, e.g. a build of an older revision.
+
+launches=${1:-1000}
+[ $# -gt 0 ] && shift
+[ $# -eq 0 ] && set -- ./cli
+
+# Programs are run from the directory of the script, './true' being one
+directory=$(mktemp -d)
+trap 'rm -rf "$directory"' EXIT
+cp /bin/true "$directory/true"
+i=0
+while [ "$i" -lt "$launches" ]
+do
+	echo ./true
+	i=$((i + 1))
+done > "$directory/script"
+
+for shell in "$@"
+do
+	binary=$(realpath "$shell")
+	round=0
+	while [ "$round" -lt 5 ]
+	do
+		(cd "$directory" && "$binary" -f script --stats 2>&1 >/dev/null)
+		round=$((round + 1))
+	done | awk -v shell="$shell" '
+		$1 == "./" && (best == "" || $3 / $2 < best) { best = $3 / $2 }
+		END { printf "%s\t%.1f us per launch\n", shell, best * 1000 }'
+done
@@ -0,0 +1,741 @@
+// Build graph definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+#include "build.h"
+#include "cache.h"
+#include "utils.h"
+
+
+/**
+ * @brief @struct type for a growing list of indexes.
+*/
+typedef struct list
+{
+	int *items;
+	int count;
+	int capacity;
+} List;
+
+
+static bool list_add(List *list, int item)
+{
+	if (list->count == list->capacity)
+	{
+		int capacity = list->capacity ? list->capacity * 2 : 16;
+		int *items = realloc(list->items, capacity * sizeof(int));
+		if (items == NULL)
+		{
+			return false;
+		}
+		list->items = items;
+		list->capacity = capacity;
+	}
+	list->items[list->count++] = item;
+	return true;
+}
+
+
+static long long modification_time(int dirfd, const char *path)
+{
+	struct stat buf;
+	if (fstatat(dirfd, path, &buf, 0) == -1)
+	{
+		return -1;
+	}
+	return buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec;
+}
+
+
+// Copy a path, changing its extension to the given letter
+static char *with_extension(const char *path, char extension)
+{
+	char *copy = strdup(path);
+	if (copy != NULL)
+	{
+		copy[strlen(copy) - 1] = extension;
+	}
+	return copy;
+}
+
+
+// Path of an included file, relative to the directory of the file including it
+static char *resolve(const char *path, const char *name, size_t length)
+{
+	const char *slash = strrchr(path, '/');
+	size_t directory = name[0] == '/' || slash == NULL ? 0 : slash - path + 1;
+	char *result = malloc(directory + length + 1);
+	if (result == NULL)
+	{
+		return NULL;
+	}
+	memcpy(result, path, directory);
+	memcpy(result + directory, name, length);
+	result[directory + length] = '\0';
+
+	// Leading "./" would make the same file look like two
+	while (result[0] == '.' && result[1] == '/')
+	{
+		memmove(result, result + 2, strlen(result + 2) + 1);
+	}
+	return result;
+}
+
+
+static int find_file(Graph *graph, char *path);
+
+
+// Read the local headers included by a file, scanning them in turn
+static void scan_includes(Graph *graph, int index)
+{
+	int fd = openat(graph->dirfd, graph->files[index].path, O_RDONLY | O_CLOEXEC);
+	FILE *stream = fd == -1 ? NULL : fdopen(fd, "r");
+	if (stream == NULL)
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		return;
+	}
+
+	char *line = NULL;
+	size_t size = 0;
+	while (getline(&line, &size, stream) != -1)
+	{
+		// Only '#include "name"' is looked for, system headers are left out
+		char *cursor = line + strspn(line, " \t");
+		if (*cursor != '#')
+		{
+			continue;
+		}
+		cursor += 1 + strspn(cursor + 1, " \t");
+		if (strncmp(cursor, "include", 7))
+		{
+			continue;
+		}
+		cursor += 7 + strspn(cursor + 7, " \t");
+		char *end = *cursor == '"' ? strchr(++cursor, '"') : NULL;
+		if (end == NULL)
+		{
+			continue;
+		}
+
+		char *path = resolve(graph->files[index].path, cursor, end - cursor);
+		int include = path ? find_file(graph, path) : -1;
+		if (include == -1 || graph->files[include].mtime == -1)
+		{
+			continue;
+		}
+		// The table of files may have moved while the header was scanned
+		Source_file *file = &graph->files[index];
+		int *includes = realloc(file->includes, (file->include_count + 1) * sizeof(int));
+		if (includes != NULL)
+		{
+			file->includes = includes;
+			file->includes[file->include_count++] = include;
+		}
+	}
+	free(line);
+	fclose(stream);
+}
+
+
+/**
+ * Get the index of a file, scanning it the first time it is met. The
+ * path is taken over by the graph. Returns -1 if memory is lacking.
+*/
+static int find_file(Graph *graph, char *path)
+{
+	for (int i = 0; i < graph->file_count; i++)
+	{
+		if (!strcmp(graph->files[i].path, path))
+		{
+			free(path);
+			return i;
+		}
+	}
+	if (graph->file_count == graph->file_capacity)
+	{
+		int capacity = graph->file_capacity ? graph->file_capacity * 2 : 16;
+		Source_file *files = realloc(graph->files, capacity * sizeof(Source_file));
+		if (files == NULL)
+		{
+			free(path);
+			return -1;
+		}
+		graph->files = files;
+		graph->file_capacity = capacity;
+	}
+
+	int index = graph->file_count++;
+	graph->files[index] = (Source_file) {.path = path, .mtime = modification_time(graph->dirfd, path)};
+	if (graph->files[index].mtime != -1)
+	{
+		scan_includes(graph, index);
+	}
+	return index;
+}
+
+
+// Add a file and all those it includes to the list, unless already marked
+static bool collect(Graph *graph, int index, List *list)
+{
+	int next = list->count;
+	if (graph->files[index].mark == graph->mark)
+	{
+		return true;
+	}
+	graph->files[index].mark = graph->mark;
+	if (!list_add(list, index))
+	{
+		return false;
+	}
+	for (; next < list->count; next++)
+	{
+		Source_file *file = &graph->files[list->items[next]];
+		for (int i = 0; i < file->include_count; i++)
+		{
+			Source_file *include = &graph->files[file->includes[i]];
+			if (include->mark != graph->mark)
+			{
+				include->mark = graph->mark;
+				if (!list_add(list, file->includes[i]))
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+
+static int add_unit(Graph *graph)
+{
+	if (graph->unit_count == graph->unit_capacity)
+	{
+		int capacity = graph->unit_capacity ? graph->unit_capacity * 2 : 16;
+		Unit *units = realloc(graph->units, capacity * sizeof(Unit));
+		if (units == NULL)
+		{
+			return -1;
+		}
+		graph->units = units;
+		graph->unit_capacity = capacity;
+	}
+	graph->units[graph->unit_count] = (Unit) {.pid = -1, .pidfd = -1, .status = -1};
+	return graph->unit_count++;
+}
+
+
+// Get the object of a source, shared by all the programs using it
+static int find_object(Graph *graph, int source)
+{
+	for (int i = 0; i < graph->unit_count; i++)
+	{
+		if (!graph->units[i].link && graph->units[i].source == graph->files[source].path)
+		{
+			return i;
+		}
+	}
+
+	// The object depends on its source and on all the headers it includes
+	List files = {0};
+	graph->mark++;
+	bool collected = collect(graph, source, &files);
+	long long newest = 0;
+	for (int i = 0; i < files.count; i++)
+	{
+		long long mtime = graph->files[files.items[i]].mtime;
+		newest = mtime > newest ? mtime : newest;
+	}
+	free(files.items);
+
+	int index = collected ? add_unit(graph) : -1;
+	if (index == -1)
+	{
+		return -1;
+	}
+	Unit *object = &graph->units[index];
+	object->source = graph->files[source].path;
+	object->output = with_extension(object->source, 'o');
+	if (object->output == NULL)
+	{
+		graph->unit_count--;
+		return -1;
+	}
+	object->newest = newest;
+	long long built = modification_time(graph->dirfd, object->output);
+	object->stale = built == -1 || built < newest;
+	return index;
+}
+
+
+/**
+ * Add the link of a program and the objects it is made of. Returns
+ * false if the program cannot be built.
+*/
+static bool add_program(Graph *graph, Build_cache *cache, bool caching, const char *source)
+{
+	char *path = resolve("", source, strlen(source));
+	int main_file = path ? find_file(graph, path) : -1;
+	if (main_file == -1 || graph->files[main_file].mtime == -1)
+	{
+		fprintf(stderr, "Error: %s: Cannot read the source file\n", source);
+		return false;
+	}
+
+	// The sources next to the headers included are part of the program
+	List files = {0}, modules = {0};
+	graph->mark++;
+	bool listed = collect(graph, main_file, &files) && list_add(&modules, main_file);
+	for (int i = 0; listed && i < files.count; i++)
+	{
+		char *name = graph->files[files.items[i]].path;
+		size_t length = strlen(name);
+		if (length < 3 || strcmp(name + length - 2, ".h"))
+		{
+			continue;
+		}
+		char *sibling = with_extension(name, 'c');
+		int module = sibling ? find_file(graph, sibling) : -1;
+		if (module != -1 && graph->files[module].mtime != -1 && graph->files[module].mark != graph->mark)
+		{
+			listed = list_add(&modules, module) && collect(graph, module, &files);
+		}
+	}
+
+	// The key covers the compiler and the name and content of every file
+	unsigned long long key = hash_bytes(MAKE_COMPILER, sizeof(MAKE_COMPILER), CACHE_SEED);
+	long long newest = 0;
+	for (int i = 0; listed && i < files.count; i++)
+	{
+		Source_file *file = &graph->files[files.items[i]];
+		key = hash_bytes(file->path, strlen(file->path) + 1, key);
+		listed = hash_file(graph->dirfd, file->path, &key);
+		newest = file->mtime > newest ? file->mtime : newest;
+	}
+	free(files.items);
+
+	// The program is named after its main source, without extension
+	char *output = listed ? strdup(graph->files[main_file].path) : NULL;
+	int index = output ? add_unit(graph) : -1;
+	if (index == -1)
+	{
+		fprintf(stderr, "Error: %s: Cannot list the files of the program\n", source);
+		free(output);
+		free(modules.items);
+		return false;
+	}
+	output[strlen(output) - 2] = '\0';
+	Unit *program = &graph->units[index];
+	program->link = true;
+	program->output = output;
+	program->key = key;
+	program->newest = newest;
+
+	// A program made of a single source needs no object
+	if (modules.count == 1)
+	{
+		program->source = graph->files[main_file].path;
+	}
+	else
+	{
+		program->inputs = calloc(modules.count, sizeof(int));
+		for (int i = 0; program->inputs != NULL && i < modules.count; i++)
+		{
+			int object = find_object(graph, modules.items[i]);
+			// Adding the object may have moved the units
+			program = &graph->units[index];
+			if (object == -1)
+			{
+				free(program->inputs);
+				program->inputs = NULL;
+				break;
+			}
+			program->inputs[program->input_count++] = object;
+		}
+		if (program->inputs == NULL)
+		{
+			fprintf(stderr, "Error: %s: Memory allocation failed\n", source);
+			program->failed = true;
+			free(modules.items);
+			return false;
+		}
+	}
+	free(modules.items);
+
+	program->cached = caching && cache_lookup(cache, program->output, key);
+	if (program->cached)
+	{
+		return true;
+	}
+
+	// Relinked when an object is rebuilt or newer than the program
+	long long built = modification_time(graph->dirfd, program->output);
+	program->stale = built == -1 || built < program->newest;
+	for (int i = 0; i < program->input_count; i++)
+	{
+		Unit *object = &graph->units[program->inputs[i]];
+		object->needed = true;
+		if (object->stale)
+		{
+			program->pending++;
+			program->stale = true;
+		}
+		if (modification_time(graph->dirfd, object->output) > built)
+		{
+			program->stale = true;
+		}
+	}
+	return true;
+}
+
+
+// Launch the compiler for a step of the build, without any shell in between
+static bool spawn_unit(Graph *graph, Unit *unit)
+{
+	char **arguments = arena_alloc(&line_arena, (unit->input_count + 6) * sizeof(char *));
+	if (arguments == NULL)
+	{
+		fprintf(command_output(), "Error: Memory allocation failed\n");
+		return false;
+	}
+	int count = 0;
+	arguments[count++] = MAKE_COMPILER;
+	if (!unit->link)
+	{
+		arguments[count++] = "-c";
+	}
+	arguments[count++] = "-o";
+	arguments[count++] = unit->output;
+	if (unit->source != NULL)
+	{
+		arguments[count++] = unit->source;
+	}
+	for (int i = 0; i < unit->input_count; i++)
+	{
+		arguments[count++] = graph->units[unit->inputs[i]].output;
+	}
+	arguments[count] = NULL;
+
+	// SIGPIPE is ignored by the shell, but the compiler must be stopped by it
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	sigset_t defaults;
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attributes, &defaults);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+
+	unit->start = get_time();
+	int error = posix_spawnp(&unit->pid, MAKE_COMPILER, NULL, &attributes, arguments, environ);
+	posix_spawnattr_destroy(&attributes);
+	if (error != 0)
+	{
+		unit->pid = -1;
+		errno = error;
+		fprintf(stderr, "Error: %s: Cannot run %s: ", unit->output, MAKE_COMPILER);
+		perror("");
+		return false;
+	}
+	// A descriptor on the process lets make wait for its own compilers only
+	unit->pidfd = syscall(__NR_pidfd_open, unit->pid, 0);
+	return true;
+}
+
+
+/**
+ * Wait for one of the compilers running, leaving alone the other children
+ * of the shell such as the stages of a pipeline or the jobs. Their
+ * descriptors are polled; a compiler without one, on older kernels, is
+ * waited for on its own. Returns the index of the unit that ended, or -1
+ * on failure.
+*/
+static int wait_unit(Graph *graph, int *status)
+{
+	struct pollfd *fds = malloc(graph->unit_count * sizeof(struct pollfd));
+	int *indices = malloc(graph->unit_count * sizeof(int));
+	if (fds == NULL || indices == NULL)
+	{
+		fprintf(command_output(), "Error: Memory allocation failed\n");
+		free(fds);
+		free(indices);
+		return -1;
+	}
+	int count = 0, blocking = -1;
+	for (int i = 0; i < graph->unit_count && blocking == -1; i++)
+	{
+		Unit *unit = &graph->units[i];
+		if (unit->pid == -1 || unit->status != -1)
+		{
+			continue;
+		}
+		if (unit->pidfd == -1)
+		{
+			blocking = i;
+			continue;
+		}
+		fds[count] = (struct pollfd) {.fd = unit->pidfd, .events = POLLIN};
+		indices[count++] = i;
+	}
+
+	int index = -1;
+	while (index == -1)
+	{
+		int candidate = blocking;
+		if (candidate == -1)
+		{
+			if (poll(fds, count, -1) == -1)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				perror("Error: poll()");
+				break;
+			}
+			for (int i = 0; i < count && candidate == -1; i++)
+			{
+				if (fds[i].revents != 0)
+				{
+					candidate = indices[i];
+				}
+			}
+		}
+
+		Unit *unit = &graph->units[candidate];
+		if (waitpid(unit->pid, status, 0) == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("Error: waitpid()");
+			break;
+		}
+		if (unit->pidfd != -1)
+		{
+			close(unit->pidfd);
+			unit->pidfd = -1;
+		}
+		index = candidate;
+	}
+	free(fds);
+	free(indices);
+	return index;
+}
+
+
+/**
+ * Stop the compilers still running once they can no longer be waited
+ * for one at a time, so that none is left behind when make returns.
+ * The steps not launched yet are failed, as they will not be.
+*/
+static void stop_units(Graph *graph)
+{
+	for (int i = 0; i < graph->unit_count; i++)
+	{
+		Unit *unit = &graph->units[i];
+		if (unit->pid != -1 && unit->status == -1)
+		{
+			kill(unit->pid, SIGTERM);
+		}
+		else if (unit->pid == -1 && unit->stale && !unit->cached && (unit->link || unit->needed))
+		{
+			unit->failed = true;
+		}
+	}
+	for (int i = 0; i < graph->unit_count; i++)
+	{
+		Unit *unit = &graph->units[i];
+		if (unit->pid == -1 || unit->status != -1)
+		{
+			continue;
+		}
+		int status;
+		pid_t pid;
+		while ((pid = waitpid(unit->pid, &status, 0)) == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (pid != -1)
+		{
+			unit->status = status;
+			unit->seconds = get_time() - unit->start;
+		}
+		unit->failed = true;
+	}
+}
+
+
+// A step ended: the programs waiting for it can go on, or are failed with it
+static void finish_unit(Graph *graph, int index, bool success)
+{
+	Unit *unit = &graph->units[index];
+	unit->failed = !success;
+	if (unit->link)
+	{
+		return;
+	}
+	for (int i = 0; i < graph->unit_count; i++)
+	{
+		Unit *program = &graph->units[i];
+		for (int j = 0; program->link && j < program->input_count; j++)
+		{
+			if (program->inputs[j] == index)
+			{
+				program->pending--;
+				program->failed |= !success;
+			}
+		}
+	}
+}
+
+
+// Whether a step can be launched now
+static bool ready(Unit *unit)
+{
+	return unit->pid == -1 && !unit->failed && unit->stale && (unit->link ? unit->pending == 0 : unit->needed);
+}
+
+
+bool build_programs(int dirfd, char **sources, int count, int jobs)
+{
+	Graph graph = {.dirfd = dirfd};
+
+	// Programs whose files did not change are taken from the cache
+	Build_cache cache;
+	bool caching = cache_open(&cache, dirfd);
+	if (!caching)
+	{
+		fprintf(stderr, "Error: Cannot open the build cache: %m\n");
+	}
+	bool success = true;
+	for (int i = 0; i < count; i++)
+	{
+		success &= add_program(&graph, &cache, caching, sources[i]);
+	}
+
+	// Keep up to 'jobs' compilers running, starting a step as soon as it is ready
+	int running = 0;
+	while (true)
+	{
+		for (int i = 0; i < graph.unit_count && running < jobs; i++)
+		{
+			Unit *unit = &graph.units[i];
+			if (!ready(unit))
+			{
+				continue;
+			}
+			if (spawn_unit(&graph, unit))
+			{
+				running++;
+			}
+			else
+			{
+				finish_unit(&graph, i, false);
+			}
+		}
+		if (running == 0)
+		{
+			break;
+		}
+
+		int status;
+		int index = wait_unit(&graph, &status);
+		if (index == -1)
+		{
+			stop_units(&graph);
+			success = false;
+			break;
+		}
+		Unit *unit = &graph.units[index];
+		unit->status = status;
+		unit->seconds = get_time() - unit->start;
+		running--;
+		finish_unit(&graph, index, WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	// Report the objects, then the programs, each in the order it was added
+	for (int i = 0; i < 2 * graph.unit_count; i++)
+	{
+		Unit *unit = &graph.units[i % graph.unit_count];
+		if (unit->link != (i >= graph.unit_count))
+		{
+			continue;
+		}
+		if (unit->link && !unit->failed && (unit->cached || !unit->stale))
+		{
+			fprintf(command_output(), "%s\tup to date\n", unit->output);
+		}
+		if (unit->status == -1)
+		{
+			success &= !unit->failed;
+			continue;
+		}
+		if (WIFEXITED(unit->status) && WEXITSTATUS(unit->status) == 0)
+		{
+			fprintf(command_output(), "%s\t%.3f s\n", unit->output, unit->seconds);
+		}
+		else if (WIFEXITED(unit->status))
+		{
+			fprintf(command_output(), "Error: %s: %s exited with status %d (%.3f s)\n", unit->output, MAKE_COMPILER,
+				WEXITSTATUS(unit->status), unit->seconds);
+		}
+		else
+		{
+			fprintf(command_output(), "Error: %s: %s was killed by signal %d (%.3f s)\n", unit->output, MAKE_COMPILER,
+				WTERMSIG(unit->status), unit->seconds);
+		}
+		success &= !unit->failed;
+	}
+
+	// Programs built, or found up to date without the cache, are added to it
+	for (int i = 0; caching && i < graph.unit_count; i++)
+	{
+		Unit *unit = &graph.units[i];
+		if (unit->link && !unit->failed && !unit->cached && unit->pending == 0)
+		{
+			cache_store(&cache, unit->output, unit->key);
+		}
+	}
+	if (caching)
+	{
+		fprintf(command_output(), "Build cache: %d hit(s), %d miss(es)\n", cache.hits, cache.misses);
+		cache_close(&cache);
+	}
+
+	// The sources belong to the files, only the outputs belong to the units
+	for (int i = 0; i < graph.unit_count; i++)
+	{
+		if (graph.units[i].pidfd != -1)
+		{
+			close(graph.units[i].pidfd);
+		}
+		free(graph.units[i].output);
+		free(graph.units[i].inputs);
+	}
+	for (int i = 0; i < graph.file_count; i++)
+	{
+		free(graph.files[i].path);
+		free(graph.files[i].includes);
+	}
+	free(graph.units);
+	free(graph.files);
+	return success;
+}
@@ -0,0 +1,105 @@
+/**
+ * Build graph declarations
+ * Programs are built from their C sources and the sources of the
+ * local headers they include, only the out of date objects being
+ * compiled again.
+*/
+#ifndef BUILD_H
+#define BUILD_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Compiler used by make, part of the key of the build cache
+#define MAKE_COMPILER "gcc"
+
+/**
+ * @brief @struct type for a file met while scanning the includes.
+ *
+ * @p includes holds the indexes of the local headers the file
+ * includes, found with '#include "..."' relative to the file.
+*/
+typedef struct source_file
+{
+	char *path;
+	long long mtime;
+	int *includes;
+	int include_count;
+	int mark;
+} Source_file;
+
+/**
+ * @brief @struct type for a step of a build: the compile of an
+ * object, or the link of a program.
+ *
+ * A program made of a single source is compiled and linked in one
+ * step, without any object. The link of a program waits for
+ * @p pending objects to be compiled.
+*/
+typedef struct unit
+{
+	char *source;
+	char *output;
+	bool link;
+	// Objects of a program
+	int *inputs;
+	int input_count;
+	int pending;
+	// Newest modification time of the files the unit is built from
+	long long newest;
+	unsigned long long key;
+	bool needed;
+	bool stale;
+	bool cached;
+	bool failed;
+	// Process running the step
+	pid_t pid;
+	int pidfd;
+	int status;
+	double start;
+	double seconds;
+} Unit;
+
+/**
+ * @brief @struct type for the dependencies of the programs to build.
+*/
+typedef struct graph
+{
+	int dirfd;
+	Source_file *files;
+	int file_count;
+	int file_capacity;
+	Unit *units;
+	int unit_count;
+	int unit_capacity;
+	int mark;
+} Graph;
+
+
+/**
+ * bool build_programs(int dirfd, char **sources, int count, int jobs)
+ * @brief Build the programs of C source files.
+ *
+ * @param[in] dirfd		Directory the paths are relative to.
+ * @param[in] sources	Main source file of each program.
+ * @param[in] count		Number of programs.
+ * @param[in] jobs		Maximum number of compilers running at once.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true if every program is up to date.
+ * 						false if a step failed.
+ *
+ * The function build_programs() scans each source for the local
+ * headers it includes, recursively. A header whose name matches a
+ * source next to it, such as 'utils.h' and 'utils.c', brings that
+ * source into the program. Each source of a program made of several
+ * is compiled into an object next to it, only when the object is
+ * older than the source or one of the headers it includes, and the
+ * objects shared by several programs are compiled once. The compiles
+ * run in parallel, and each program is linked as soon as all of its
+ * objects are ready. Programs whose files did not change are found
+ * in the build cache and not linked again.
+*/
+bool build_programs(int dirfd, char **sources, int count, int jobs);
+
+
+#endif // BUILD_H
@@ -0,0 +1,361 @@
+// Build cache definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "copy.h"
+#include "utils.h"
+
+
+unsigned long long hash_bytes(const void *data, size_t length, unsigned long long hash)
+{
+	const unsigned char *bytes = data;
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+
+bool hash_file(int dirfd, const char *path, unsigned long long *hash)
+{
+	int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		return false;
+	}
+	char buffer[SIZE_INPUT];
+	ssize_t bytes;
+	while ((bytes = read(fd, buffer, sizeof(buffer))) != 0)
+	{
+		if (bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			close(fd);
+			return false;
+		}
+		*hash = hash_bytes(buffer, bytes, *hash);
+	}
+	close(fd);
+	return true;
+}
+
+
+// Name of the copy of an executable in the folder of the cache
+static void key_name(unsigned long long key, char name[17])
+{
+	snprintf(name, 17, "%016llx", key);
+}
+
+
+static Build *find_build(Build_cache *cache, const char *output)
+{
+	for (int i = 0; i < cache->count; i++)
+	{
+		if (!strcmp(cache->builds[i].output, output))
+		{
+			return &cache->builds[i];
+		}
+	}
+	return NULL;
+}
+
+
+// Get a new entry at the end of the index, NULL if memory is lacking
+static Build *add_build(Build_cache *cache, const char *output)
+{
+	if (cache->count == cache->capacity)
+	{
+		int capacity = cache->capacity ? cache->capacity * 2 : 16;
+		Build *builds = realloc(cache->builds, capacity * sizeof(Build));
+		if (builds == NULL)
+		{
+			return NULL;
+		}
+		cache->builds = builds;
+		cache->capacity = capacity;
+	}
+	Build *build = &cache->builds[cache->count];
+	build->output = strdup(output);
+	if (build->output == NULL)
+	{
+		return NULL;
+	}
+	cache->count++;
+	return build;
+}
+
+
+// Record the executable as built from the key, as it is now on disk
+static void record_build(Build_cache *cache, const char *output, unsigned long long key)
+{
+	struct stat buf;
+	if (fstatat(cache->dirfd, output, &buf, 0) == -1)
+	{
+		return;
+	}
+	Build *build = find_build(cache, output);
+	if (build == NULL && (build = add_build(cache, output)) == NULL)
+	{
+		return;
+	}
+	build->key = key;
+	build->mtime = buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec;
+	build->size = buf.st_size;
+}
+
+
+bool cache_open(Build_cache *cache, int dirfd)
+{
+	memset(cache, 0, sizeof(*cache));
+	cache->dirfd = dirfd;
+	cache->fd = -1;
+	if (mkdirat(dirfd, CACHE_DIR, S_IRWXU) == -1 && errno != EEXIST)
+	{
+		return false;
+	}
+	cache->fd = openat(dirfd, CACHE_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cache->fd == -1)
+	{
+		return false;
+	}
+
+	int fd = openat(cache->fd, CACHE_INDEX, O_RDONLY | O_CLOEXEC);
+	FILE *index = fd == -1 ? NULL : fdopen(fd, "r");
+	if (index == NULL)
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		return true;
+	}
+
+	// Each line holds: key, modification time, size and path of an executable
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t length;
+	while ((length = getline(&line, &size, index)) != -1)
+	{
+		if (length > 0 && line[length - 1] == '\n')
+		{
+			line[length - 1] = '\0';
+		}
+		unsigned long long key;
+		long long mtime, bytes;
+		int offset = 0;
+		if (sscanf(line, "%llx %lld %lld %n", &key, &mtime, &bytes, &offset) != 3 || offset == 0
+			|| line[offset] == '\0' || find_build(cache, line + offset) != NULL)
+		{
+			continue;
+		}
+		Build *build = add_build(cache, line + offset);
+		if (build == NULL)
+		{
+			break;
+		}
+		build->key = key;
+		build->mtime = mtime;
+		build->size = bytes;
+	}
+	free(line);
+	fclose(index);
+	return true;
+}
+
+
+/**
+ * @brief @struct type for a copy found in the folder of the cache.
+*/
+typedef struct copy
+{
+	char name[17];
+	long long mtime;
+	long long size;
+} Copy;
+
+
+static int compare_copies(const void *a, const void *b)
+{
+	const Copy *first = a, *second = b;
+	return (first->mtime > second->mtime) - (first->mtime < second->mtime);
+}
+
+
+// Whether an executable of the index was built from the copy
+static bool referenced(Build_cache *cache, const char *name)
+{
+	char key[17];
+	for (int i = 0; i < cache->count; i++)
+	{
+		key_name(cache->builds[i].key, key);
+		if (!strcmp(key, name))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/**
+ * Drop the executables removed from the directory, then delete the
+ * copies left unused for the longest time once the others would
+ * take more than CACHE_BUDGET bytes.
+*/
+static void prune(Build_cache *cache)
+{
+	struct stat buf;
+	for (int i = 0; i < cache->count; )
+	{
+		if (fstatat(cache->dirfd, cache->builds[i].output, &buf, 0) == -1 && errno == ENOENT)
+		{
+			free(cache->builds[i].output);
+			cache->builds[i] = cache->builds[--cache->count];
+			continue;
+		}
+		i++;
+	}
+
+	int fd = dup(cache->fd);
+	DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+	if (dir == NULL)
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		return;
+	}
+	rewinddir(dir);
+	Copy *copies = NULL;
+	size_t count = 0, capacity = 0;
+	long long total = 0;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (strlen(entry->d_name) != 16 || strspn(entry->d_name, "0123456789abcdef") != 16
+			|| referenced(cache, entry->d_name) || fstatat(cache->fd, entry->d_name, &buf, AT_SYMLINK_NOFOLLOW) == -1)
+		{
+			continue;
+		}
+		if (count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 16;
+			Copy *grown = realloc(copies, capacity * sizeof(Copy));
+			if (grown == NULL)
+			{
+				break;
+			}
+			copies = grown;
+		}
+		memcpy(copies[count].name, entry->d_name, 17);
+		copies[count].mtime = buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec;
+		copies[count].size = buf.st_blocks * 512;
+		total += copies[count].size;
+		count++;
+	}
+	closedir(dir);
+
+	qsort(copies, count, sizeof(Copy), compare_copies);
+	for (size_t i = 0; i < count && total > CACHE_BUDGET; i++)
+	{
+		if (unlinkat(cache->fd, copies[i].name, 0) == 0)
+		{
+			total -= copies[i].size;
+		}
+	}
+	free(copies);
+}
+
+
+bool cache_lookup(Build_cache *cache, const char *output, unsigned long long key)
+{
+	// Built from the same source and flags, and left untouched since
+	Build *build = find_build(cache, output);
+	struct stat buf;
+	if (build != NULL && build->key == key && fstatat(cache->dirfd, output, &buf, 0) == 0
+		&& build->mtime == buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec
+		&& build->size == buf.st_size)
+	{
+		cache->hits++;
+		return true;
+	}
+
+	// Built before, from another version of the source for instance
+	char name[17];
+	key_name(key, name);
+	if (copy_file(cache->fd, name, cache->dirfd, output))
+	{
+		// The copy was just used: it is the last to be evicted
+		utimensat(cache->fd, name, NULL, 0);
+		record_build(cache, output, key);
+		cache->hits++;
+		return true;
+	}
+	cache->misses++;
+	return false;
+}
+
+
+void cache_store(Build_cache *cache, const char *output, unsigned long long key)
+{
+	char name[17];
+	key_name(key, name);
+	if (!copy_file(cache->dirfd, output, cache->fd, name))
+	{
+		fprintf(stderr, "Error: Cannot add '%s' to the build cache: %m\n", output);
+		return;
+	}
+	utimensat(cache->fd, name, NULL, 0);
+	record_build(cache, output, key);
+}
+
+
+void cache_close(Build_cache *cache)
+{
+	if (cache->fd != -1)
+	{
+		prune(cache);
+		int fd = openat(cache->fd, CACHE_INDEX ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+		FILE *index = fd == -1 ? NULL : fdopen(fd, "w");
+		if (index != NULL)
+		{
+			for (int i = 0; i < cache->count; i++)
+			{
+				Build *build = &cache->builds[i];
+				fprintf(index, "%016llx %lld %lld %s\n", build->key, build->mtime, build->size, build->output);
+			}
+			if (fclose(index) == 0)
+			{
+				renameat(cache->fd, CACHE_INDEX ".tmp", cache->fd, CACHE_INDEX);
+			}
+		}
+		else if (fd != -1)
+		{
+			close(fd);
+		}
+		close(cache->fd);
+	}
+	for (int i = 0; i < cache->count; i++)
+	{
+		free(cache->builds[i].output);
+	}
+	free(cache->builds);
+	memset(cache, 0, sizeof(*cache));
+	cache->fd = -1;
+}
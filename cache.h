@@ -0,0 +1,148 @@
+/**
+ * Build cache declarations
+ * Executables built by make are stored under the hash of what they
+ * were built from, so that unchanged sources are not compiled again.
+*/
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdbool.h>
+
+// Folder of the cache, in the working directory
+#define CACHE_DIR ".cli_cache"
+// Index of the executables built, in the folder of the cache
+#define CACHE_INDEX "index"
+// Starting value of a hash
+#define CACHE_SEED 14695981039346656037ULL
+// Size of the copies of older builds kept in the folder of the cache at most
+#ifndef CACHE_BUDGET
+#define CACHE_BUDGET (64 * 1024 * 1024)
+#endif
+
+/**
+ * @brief @struct type for an executable built by make.
+ * 
+ * The size and modification time of the executable are recorded
+ * when it is built or restored, so that an executable changed since
+ * then is not mistaken for an up to date one.
+*/
+typedef struct build
+{
+	char *output;
+	unsigned long long key;
+	long long mtime;
+	long long size;
+} Build;
+
+/**
+ * @brief @struct type for the build cache of a directory.
+ * 
+ * The folder of the cache holds a copy of every executable built,
+ * named after its key, along with an index of the executables of
+ * the directory. The modification time of a copy is the last time
+ * it was stored or restored. The number of compiles avoided and done
+ * are counted.
+*/
+typedef struct build_cache
+{
+	int dirfd;
+	int fd;
+	Build *builds;
+	int count;
+	int capacity;
+	int hits;
+	int misses;
+} Build_cache;
+
+
+/**
+ * unsigned long long hash_bytes(const void *data, size_t length, unsigned long long hash)
+ * @brief Add bytes to a 64-bit FNV-1a hash.
+ * 
+ * @param[in] data		Bytes to add.
+ * @param[in] length	Number of bytes.
+ * @param[in] hash		Hash so far, or CACHE_SEED to start one.
+ * @return				The updated hash.
+*/
+unsigned long long hash_bytes(const void *data, size_t length, unsigned long long hash);
+
+
+/**
+ * bool hash_file(int dirfd, const char *path, unsigned long long *hash)
+ * @brief Add the content of a file to a hash.
+ * 
+ * @param[in] dirfd		Directory @p path is relative to.
+ * @param[in] path		Path of the file.
+ * @param[in,out] hash	Hash to update.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if the file cannot be read.
+*/
+bool hash_file(int dirfd, const char *path, unsigned long long *hash);
+
+
+/**
+ * bool cache_open(Build_cache *cache, int dirfd)
+ * @brief Open the build cache of a directory.
+ * 
+ * @param[out] cache	Cache to open.
+ * @param[in] dirfd		Directory the cache belongs to.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if the folder of the cache cannot be used.
+ * 
+ * The function cache_open() creates the folder of the cache if needed
+ * and loads its index. A missing or damaged index is an empty one.
+*/
+bool cache_open(Build_cache *cache, int dirfd);
+
+
+/**
+ * bool cache_lookup(Build_cache *cache, const char *output, unsigned long long key)
+ * @brief Make an executable up to date from the cache.
+ * 
+ * @param[in] cache		Cache to look the executable up in.
+ * @param[in] output	Path of the executable.
+ * @param[in] key		Hash of the source and of the compile flags.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true if the executable is up to date.
+ * 						false if it has to be built.
+ * 
+ * The function cache_lookup() counts a hit when @p output was last
+ * built from @p key and has not changed since, or when a copy built
+ * from @p key is found in the cache and restored to @p output .
+ * Otherwise, a miss is counted.
+*/
+bool cache_lookup(Build_cache *cache, const char *output, unsigned long long key);
+
+
+/**
+ * void cache_store(Build_cache *cache, const char *output, unsigned long long key)
+ * @brief Add a freshly built executable to the cache.
+ * 
+ * @param[in] cache		Cache to add the executable to.
+ * @param[in] output	Path of the executable.
+ * @param[in] key		Hash of the source and of the compile flags.
+ * @return				Nothing.
+*/
+void cache_store(Build_cache *cache, const char *output, unsigned long long key);
+
+
+/**
+ * void cache_close(Build_cache *cache)
+ * @brief Save the index of a cache and free it.
+ * 
+ * @param[in] cache		Cache to close.
+ * @return				Nothing.
+ * 
+ * The function cache_close() first drops from the index the
+ * executables removed from the directory. The copies the index does
+ * not point to anymore are then deleted, least recently used first,
+ * until those left take at most CACHE_BUDGET bytes. The index is
+ * written to a temporary file, renamed over the previous one, so that
+ * an interrupted make never leaves a partial index behind.
+*/
+void cache_close(Build_cache *cache);
+
+
+#endif // CACHE_H
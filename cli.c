@@ -7,107 +7,349 @@
  * course.
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 #include "utils.h"
 #include "commands.h"
+#include "pipeline.h"
+#include "jobs.h"
+#include "editor.h"
+#include "dircache.h"
+#include "du.h"
+
+
+/**
+ * @brief @struct type to accumulate the usage of a command.
+*/
+typedef struct usage
+{
+	unsigned long calls;
+	double seconds;
+} Usage;
+
+
+/**
+ * @brief @struct type for the measures of a command run with 'time'.
+ * 
+ * The phases are given in seconds. The resources are those used by
+ * the command: by the shell itself for a builtin, its threads and
+ * the programs it waited for included, or by the program for './'.
+ * A pipeline is measured as a whole, as a builtin is.
+*/
+typedef struct timing
+{
+	double parse;
+	double dispatch;
+	double execution;
+	struct rusage usage;
+	bool builtin;
+} Timing;
+
+
+static double seconds(struct timeval time)
+{
+	return time.tv_sec + time.tv_usec / 1e6;
+}
 
 
-int main(void)
+// Resources used between two measures of the shell and of its children
+static void usage_since(const struct rusage *self, const struct rusage *children, struct rusage *usage)
 {
-	printf("**** To exit the program, type 'exit' ****\n");
+	struct rusage now_self, now_children;
+	getrusage(RUSAGE_SELF, &now_self);
+	getrusage(RUSAGE_CHILDREN, &now_children);
 
-	// Allocate memory for the input buffer
-	char *input = malloc(SIZE_INPUT);
-	if (input == NULL)
+	timersub(&now_self.ru_utime, &self->ru_utime, &usage->ru_utime);
+	timersub(&now_self.ru_stime, &self->ru_stime, &usage->ru_stime);
+	timeradd(&usage->ru_utime, &now_children.ru_utime, &usage->ru_utime);
+	timersub(&usage->ru_utime, &children->ru_utime, &usage->ru_utime);
+	timeradd(&usage->ru_stime, &now_children.ru_stime, &usage->ru_stime);
+	timersub(&usage->ru_stime, &children->ru_stime, &usage->ru_stime);
+	// The peak of the shell so far, the kernel keeps no other
+	usage->ru_maxrss = now_self.ru_maxrss > now_children.ru_maxrss ? now_self.ru_maxrss : now_children.ru_maxrss;
+	usage->ru_nvcsw = now_self.ru_nvcsw - self->ru_nvcsw + now_children.ru_nvcsw - children->ru_nvcsw;
+	usage->ru_nivcsw = now_self.ru_nivcsw - self->ru_nivcsw + now_children.ru_nivcsw - children->ru_nivcsw;
+}
+
+
+// Print the measures of a command on stderr, as the shell's 'time' does
+static void print_timing(const Timing *timing)
+{
+	const struct rusage *usage = &timing->usage;
+	fprintf(stderr, "real\t%.6f s\n", timing->parse + timing->dispatch + timing->execution);
+	if (timing->builtin)
 	{
-		printf("Error: 'input' memory allocation failed\n");
-		return 1;
+		fprintf(stderr, "  parse\t%.6f s\n  dispatch\t%.6f s\n  execution\t%.6f s\n",
+			timing->parse, timing->dispatch, timing->execution);
 	}
+	fprintf(stderr, "user\t%.6f s\nsys\t%.6f s\n", seconds(usage->ru_utime), seconds(usage->ru_stime));
+	fprintf(stderr, "max RSS\t%ld KiB\n", usage->ru_maxrss);
+	fprintf(stderr, "context switches\t%ld voluntary, %ld involuntary\n", usage->ru_nvcsw, usage->ru_nivcsw);
+}
 
-	// Run until the 'exit' command is entered
-	do
+
+// Print the usage statistics of the session on stderr
+static void print_stats(const Usage *usage, unsigned long total, double elapsed)
+{
+	fprintf(stderr, "%lu commands in %.3f s (%.0f commands/s)\n",
+		total, elapsed, elapsed > 0 ? total / elapsed : 0.0);
+	fprintf(stderr, "command\tcalls\ttotal (ms)\n");
+	for (int i = 0; i <= command_count; i++)
 	{
-		printf("£ ");
+		if (usage[i].calls)
+		{
+			fprintf(stderr, "%s\t%lu\t%.3f\n", i < command_count ? commands[i].name : "./",
+				usage[i].calls, usage[i].seconds * 1000);
+		}
+	}
+	fprintf(stderr, "arena\t%zu malloc(), %zu free()\n", line_arena.mallocs, line_arena.frees);
+	fprintf(stderr, "ls cache\t%lu hit(s), %lu miss(es)\n", dir_cache.hits, dir_cache.misses);
+	fprintf(stderr, "du cache\t%lu directories reused, %lu scanned\n",
+		atomic_load(&du_reused), atomic_load(&du_scanned));
+}
 
-		// Wait for input
-		if (get_input(input))
+
+int main(int argc, char **argv)
+{
+	Reader *reader = &stdin_reader;
+	Reader script = {0};
+	bool stats = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--stats"))
 		{
-			Token *head = parse_input(input);
-			if (head == NULL)
+			stats = true;
+		}
+		else if (!strcmp(argv[i], "-f") && i + 1 < argc && reader == &stdin_reader)
+		{
+			i++;
+			script.fd = open(argv[i], O_RDONLY);
+			if (script.fd == -1)
 			{
-				printf("Error: Parsing failed\n");
-				continue;
+				fprintf(stderr, "Error: %s: ", argv[i]);
+				perror("");
+				return 1;
 			}
+			reader = &script;
+		}
+		else
+		{
+			fprintf(stderr, "Usage: %s [-f script] [--stats]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	// A command out of its slot could never be found
+	if (!check_registry())
+	{
+		return 1;
+	}
 
-			int argc = get_argc(head);
-			char *command = get_argv(head, 0);
+	// A command of a pipeline whose reader is gone gets EPIPE instead of ending the shell
+	signal(SIGPIPE, SIG_IGN);
+	// Programs started in the background are reaped as soon as they end
+	jobs_init();
 
-			/**
-			 * @note To improve if more commands are added.
-			 * Search time: poor (linear).
-			 * Code maintenance: medium (will get worse with more
-			 * commands)
-			*/ 
-			if (!strcmp(command, "echo"))
-			{
-				echo(head, argc);
-			}
-			else if (!strcmp(command, "pwd"))
-			{
-				pwd();
-			}
-			else if (!strcmp(command, "ls"))
+	// Paths given to the builtins are resolved from this directory
+	if (!cwd_init())
+	{
+		perror("Error: Cannot open the working directory");
+	}
+
+	// Prompts are only displayed when a user is typing the commands
+	bool interactive = reader == &stdin_reader && isatty(STDIN_FILENO);
+	if (interactive)
+	{
+		printf("**** To exit the program, type 'exit' ****\n");
+	}
+	// Lines typed on a terminal are edited, with completion
+	Editor editor;
+	bool editing = interactive && editor_init(&editor);
+
+	/**
+	 * Usage of each registered command, the last slot being used for
+	 * the executables launched with run().
+	*/
+	Usage *usage = calloc(command_count + 1, sizeof(Usage));
+	if (usage == NULL)
+	{
+		printf("Error: 'usage' memory allocation failed\n");
+		return 1;
+	}
+	unsigned long total = 0;
+	double start = get_time();
+
+	Args args = {0};
+	char *input = NULL;
+	// Exit status of the last program run, returned by the shell as well
+	int status = 0;
+
+	// Run until the 'exit' command is entered or the input ends
+	while (true)
+	{
+		// The jobs that ended since the last command are announced
+		jobs_notify();
+
+		if (interactive && !editing)
+		{
+			printf("£ ");
+			fflush(stdout);
+		}
+
+		// Everything allocated for the previous command line is released
+		arena_reset(&line_arena);
+
+		// Wait for input
+		if (editing ? !edit_line(&editor, "£ ", &input) : !get_input(reader, &input))
+		{
+			if (interactive)
 			{
-				ls(head, argc);
+				printf("\n");
 			}
-			else if (!strcmp(command, "cd"))
+			break;
+		}
+		if (input[0] != '\0')
+		{
+			double begin = get_time();
+			if (!parse_input(input, &args))
 			{
-				cd(head, argc);
+				printf("Error: Parsing failed\n");
+				continue;
 			}
-			else if (!strcmp(command, "touch"))
+			if (args.argc == 0)
 			{
-				touch(head, argc);
+				continue;
 			}
-			else if (!strcmp(command, "rm"))
+
+			// A command prefixed with 'time' is measured
+			Timing timing = {0};
+			bool timed = args.argv[0] != NULL && !strcmp(args.argv[0], "time");
+			if (timed)
 			{
-				rm(head, argc);
+				if (args.argc == 1)
+				{
+					printf("Error: time: Missing command\n");
+					continue;
+				}
+				args.argv++;
+				args.argc--;
 			}
-			else if (!strcmp(command, "mkdir"))
+			char *command = args.argv[0];
+			double parsed = get_time();
+			struct rusage self, children;
+			if (timed)
 			{
-				mkdir_cli(head, argc);
+				getrusage(RUSAGE_SELF, &self);
+				getrusage(RUSAGE_CHILDREN, &children);
 			}
-			else if (!strcmp(command, "rmdir"))
+
+			// Builtin commands are found in the perfect hash table of the registry
+			const Command *entry = args.pipes ? NULL : find_command(command);
+			int slot = -1;
+			double dispatched = parsed;
+			bool pipeline = false;
+			if (args.background)
 			{
-				rmdir_cli(head, argc);
+				// Only a program can run on its own while the shell goes on
+				if (args.pipes || entry != NULL)
+				{
+					printf("Error: Only a program can run in the background\n");
+				}
+				else
+				{
+					dispatched = get_time();
+					status = job_start(args.argc, args.argv) ? 0 : 1;
+					slot = command_count;
+				}
 			}
-			else if (!strcmp(command, "mv"))
+			else if (args.pipes)
 			{
-				mv(head, argc);
+				dispatched = get_time();
+				status = run_pipeline(args.argc, args.argv);
+				pipeline = true;
 			}
-			else if (!strcmp(command, "cat"))
+			else if (entry != NULL)
 			{
-				cat(head, argc);
+				if (entry->handler == NULL)
+				{
+					break;
+				}
+				if (check_arguments(entry, args.argc, args.argv))
+				{
+					dispatched = get_time();
+					entry->handler(args.argc, args.argv);
+					slot = entry - commands;
+					timing.builtin = true;
+				}
 			}
-			else if (!strcmp(command, "make"))
+			else
 			{
-				make(head, argc);
+				// Anything else is a program file, or a program of $PATH
+				dispatched = get_time();
+				status = run(args.argc, args.argv, timed ? &timing.usage : NULL);
+				slot = command_count;
 			}
-			else if (command[0] == '.')
+			double end = get_time();
+
+			if (timed)
 			{
-				run(head, argc);
+				fflush(stdout);
+				timing.parse = parsed - begin;
+				bool executed = slot != -1 || pipeline;
+				timing.dispatch = executed ? dispatched - parsed : end - parsed;
+				timing.execution = executed ? end - dispatched : 0;
+				if (slot != command_count)
+				{
+					usage_since(&self, &children, &timing.usage);
+				}
+				print_timing(&timing);
 			}
-			else if (strcmp(command, "exit"))
+			if (slot != -1)
 			{
-				printf("Error: %s: Unknown command\n", command);
+				usage[slot].calls++;
+				usage[slot].seconds += end - parsed;
+				total++;
 			}
-			free_tokens(head);
 		}
-	} while (strcasecmp(input, "exit"));
+	}
 
-	free(input);
-    return 0;
+	// Make sure the output of the commands comes before the statistics
+	fflush(stdout);
+	if (stats)
+	{
+		print_stats(usage, total, get_time() - start);
+	}
+#ifdef DEBUG
+	printf("Arena: %zu malloc(), %zu free()\n", line_arena.mallocs, line_arena.frees);
+#endif
+	arena_free(&line_arena);
+	free(stdin_reader.buffer);
+	if (reader == &script)
+	{
+		close(script.fd);
+		free(script.buffer);
+	}
+	free(usage);
+	jobs_free();
+	dir_cache_free();
+	if (editing)
+	{
+		editor_free(&editor);
+	}
+	if (cwd.fd != AT_FDCWD)
+	{
+		close(cwd.fd);
+	}
+    return status;
 }
-
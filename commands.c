@@ -1,48 +1,525 @@
 // Implement the input command functions
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
 #include <sys/stat.h>
 #include <sys/dir.h>
 #include <sys/wait.h>
+#include <spawn.h>
+#include <signal.h>
 
 #include "commands.h"
+#include "sort.h"
+#include "walker.h"
+#include "batch.h"
+#include "copy.h"
+#include "build.h"
+#include "jobs.h"
+#include "path.h"
+#include "dircache.h"
+#include "du.h"
 
 
-void echo(Token *head, int argc)
+void echo(int argc, char **argv)
 {
+	FILE *out = command_output();
 	for (int i = 1; i < argc; i++)
 	{
-		printf("%s ", get_argv(head, i));
+		fprintf(out, "%s ", argv[i]);
 	}
-	printf("\n");
+	fputc('\n', out);
+}
+
+
+void pwd(int argc, char **argv)
+{
+	(void) argc;
+	(void) argv;
+
+	// The path is kept up to date by cd
+	fprintf(command_output(), "%s\n", cwd.path);
 }
 
 
-void pwd()
+/**
+ * Get the number of threads given with the option '-j', the number of
+ * online processors being used by default.
+*/
+static bool take_threads(int *argc, char **argv, int *threads)
 {
-	char curdir[PATH_MAX] = {0};
-	// https://man7.org/linux/man-pages/man3/getcwd.3.html
-	if (!getcwd(curdir, PATH_MAX))
+	char *value = NULL;
+	if (!take_value(argc, argv, "-j", &value))
+	{
+		return false;
+	}
+	*threads = default_threads();
+	if (value != NULL)
 	{
-		perror("Error: getcwd()");
+		*threads = atoi(value);
+		if (*threads < 1)
+		{
+			fprintf(command_output(), "Error: '%s': Invalid number of threads\n", value);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/**
+ * @brief @struct type for a piece of output of a parallel walk.
+*/
+typedef struct chunk
+{
+	char *path;
+	char *text;
+	size_t length;
+} Chunk;
+
+/**
+ * @brief @struct type gathering the output of the directories of a
+ * parallel walk.
+ * 
+ * Each directory produces its output as a whole. Unless @p ordered is
+ * set, it is displayed right away. Otherwise, it is kept until the end
+ * of the walk and displayed in the order of the paths.
+*/
+typedef struct output
+{
+	pthread_mutex_t lock;
+	// Stream of the command, the walker threads having none of their own
+	FILE *out;
+	bool ordered;
+	Chunk *chunks;
+	size_t count;
+	size_t size;
+} Output;
+
+
+// Hand the output of a directory over, @p text being freed afterwards
+static void output_add(Output *output, const char *path, char *text, size_t length)
+{
+	pthread_mutex_lock(&output->lock);
+	if (!output->ordered)
+	{
+		fwrite(text, 1, length, output->out);
+		pthread_mutex_unlock(&output->lock);
+		free(text);
 		return;
 	}
-	printf("%s\n", curdir);
+
+	if (output->count == output->size)
+	{
+		size_t size = output->size ? output->size * 2 : 256;
+		Chunk *chunks = realloc(output->chunks, size * sizeof(Chunk));
+		if (chunks == NULL)
+		{
+			pthread_mutex_unlock(&output->lock);
+			fprintf(command_output(), "Error: Output memory allocation failed\n");
+			free(text);
+			return;
+		}
+		output->chunks = chunks;
+		output->size = size;
+	}
+	Chunk *chunk = &output->chunks[output->count];
+	chunk->path = strdup(path);
+	chunk->text = text;
+	chunk->length = length;
+	if (chunk->path == NULL)
+	{
+		free(text);
+	}
+	else
+	{
+		output->count++;
+	}
+	pthread_mutex_unlock(&output->lock);
+}
+
+
+/**
+ * Compare two paths component by component, so that a directory comes
+ * right before its content.
+*/
+static int compare_paths(const void *a, const void *b)
+{
+	const unsigned char *first = (const unsigned char *) ((const Chunk *) a)->path;
+	const unsigned char *second = (const unsigned char *) ((const Chunk *) b)->path;
+	while (*first != '\0' && *first == *second)
+	{
+		first++;
+		second++;
+	}
+	int key_first = *first == '/' ? 1 : *first ? *first + 1 : 0;
+	int key_second = *second == '/' ? 1 : *second ? *second + 1 : 0;
+	return key_first - key_second;
+}
+
+
+// Display the output kept by an ordered walk, and free it
+static void output_flush(Output *output)
+{
+	qsort(output->chunks, output->count, sizeof(Chunk), compare_paths);
+	for (size_t i = 0; i < output->count; i++)
+	{
+		fwrite(output->chunks[i].text, 1, output->chunks[i].length, output->out);
+		free(output->chunks[i].text);
+		free(output->chunks[i].path);
+	}
+	free(output->chunks);
+	output->chunks = NULL;
+	output->count = output->size = 0;
+}
+
+
+// Display the type and permissions of a file, as 'ls -l' does
+static void print_mode(FILE *out, mode_t mode)
+{
+	fprintf(out, "%c%c%c%c%c%c%c%c%c%c\t",
+		(S_ISDIR(mode)) ? 'd' : (S_ISLNK(mode)) ? 'l' : '-',
+		(mode & S_IRUSR) ? 'r' : '-',
+		(mode & S_IWUSR) ? 'w' : '-',
+		(mode & S_IXUSR) ? 'x' : '-',
+		(mode & S_IRGRP) ? 'r' : '-',
+		(mode & S_IWGRP) ? 'w' : '-',
+		(mode & S_IXGRP) ? 'x' : '-',
+		(mode & S_IROTH) ? 'r' : '-',
+		(mode & S_IWOTH) ? 'w' : '-',
+		(mode & S_IXOTH) ? 'x' : '-');
+}
+
+
+// Convert the type of a directory entry to the file type bits of a mode
+static mode_t dtype_to_mode(unsigned char type)
+{
+	switch (type)
+	{
+		case DT_REG: return S_IFREG;
+		case DT_DIR: return S_IFDIR;
+		case DT_LNK: return S_IFLNK;
+		case DT_FIFO: return S_IFIFO;
+		case DT_SOCK: return S_IFSOCK;
+		case DT_CHR: return S_IFCHR;
+		case DT_BLK: return S_IFBLK;
+		default: return 0;
+	}
+}
+
+
+/**
+ * @brief @struct type for the options of 'ls'.
+*/
+typedef struct listing
+{
+	bool invisible;
+	bool details;
+	Compare compare;
+	// Fields of the files needed for the details or the sort order
+	unsigned int mask;
+	int threads;
+	// Memory allowed to sort the entries
+	size_t budget;
+	// Stream to display the entries to
+	FILE *out;
+	// Flag to display header once only
+	bool flag;
+	// Output of a recursive listing
+	Output *output;
+} Listing;
+
+
+// Orders of the entries: by name, by decreasing size or by newest first
+static int compare_name(const Record *a, const Record *b)
+{
+	return strcmp(a->name, b->name);
+}
+
+static int compare_size(const Record *a, const Record *b)
+{
+	if (a->size != b->size)
+	{
+		return a->size < b->size ? 1 : -1;
+	}
+	return strcmp(a->name, b->name);
+}
+
+static int compare_mtime(const Record *a, const Record *b)
+{
+	if (a->mtime != b->mtime)
+	{
+		return a->mtime < b->mtime ? 1 : -1;
+	}
+	return strcmp(a->name, b->name);
+}
+
+
+// Display a directory entry once its position is known
+static void print_entry(const Record *record, void *context)
+{
+	Listing *listing = context;
+	if (listing->details)
+	{
+		if (!listing->flag)
+		{
+			fprintf(listing->out, "mode\t\tsize\tname\n");
+			listing->flag = true;
+		}
+		/// @note More information could be displayed
+		print_mode(listing->out, record->mode);
+		fprintf(listing->out, "%lli\t", record->size);
+	}
+	fprintf(listing->out, "%s\n", record->name);
+}
+
+
+/**
+ * Get the fields of an entry of the directory @p fd . The file is only
+ * examined when the details or the sort order need it, for the fields
+ * used, and for its type only when the directory entry lacks it.
+*/
+static bool entry_fields(Listing *listing, int fd, const char *name, unsigned char d_type, Record *fields)
+{
+	memset(fields, 0, sizeof(Record));
+	if (listing->mask)
+	{
+		mode_t type = dtype_to_mode(d_type);
+		unsigned int mask = listing->mask | (type || !listing->details ? 0 : STATX_TYPE);
+		struct statx buf;
+		if (statx(fd, name, AT_SYMLINK_NOFOLLOW, mask, &buf) == -1)
+		{
+			fprintf(stderr, "Error: %s: %m\n", name);
+			return false;
+		}
+		fields->mode = type ? type | (buf.stx_mode & ~S_IFMT) : buf.stx_mode;
+		fields->size = buf.stx_size;
+		fields->mtime = buf.stx_mtime.tv_sec * 1000000000LL + buf.stx_mtime.tv_nsec;
+	}
+	return true;
+}
+
+
+// Add an entry of the directory @p fd to a sorter
+static bool add_entry(Sorter *sorter, Listing *listing, int fd, const char *name, unsigned char d_type)
+{
+	Record fields;
+	if (!entry_fields(listing, fd, name, d_type, &fields))
+	{
+		return true;
+	}
+	return sorter_add(sorter, &fields, name);
+}
+
+
+/**
+ * @brief @struct type for the destination of the entries of a listing
+ * found in the cache.
+*/
+typedef struct cached_listing
+{
+	Sorter *sorter;
+	Listing *listing;
+} Cached_listing;
+
+
+static void add_cached(const Record *record, void *context)
+{
+	Cached_listing *cached = context;
+	if (cached->listing->invisible || record->name[0] != '.')
+	{
+		sorter_add(cached->sorter, record, record->name);
+	}
+}
+
+
+/**
+ * Display the content of a single directory. The names come from the
+ * directory stream and go through an external merge sort, which
+ * bounds the memory used for large directories. The entries read are
+ * kept in the listing cache, so that a directory listed again is not
+ * read again until it changes.
+*/
+static void list_directory(const char *path, Listing *listing)
+{
+	int fd = openat(cwd.fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		fprintf(command_output(), "Error: Cannot open directory: %s\n", path);
+		return;
+	}
+
+	Sorter sorter;
+	sorter_init(&sorter, listing->compare, listing->budget);
+	listing->flag = false;
+
+	Cached_listing cached = {.sorter = &sorter, .listing = listing};
+	if (dir_cache_list(fd, listing->mask, listing->invisible, add_cached, &cached))
+	{
+		close(fd);
+		sorter_finish(&sorter, print_entry, listing);
+		sorter_free(&sorter);
+		return;
+	}
+
+	DIR *dir = fdopendir(fd);
+	if (dir == NULL)
+	{
+		close(fd);
+		sorter_free(&sorter);
+		fprintf(command_output(), "Error: Cannot open directory: %s\n", path);
+		return;
+	}
+
+	// Hidden entries are neither examined nor cached unless displayed
+	Cached_dir *listed = dir_cache_begin(fd, listing->mask, listing->invisible);
+	bool complete = true;
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		if (!listing->invisible && (entry->d_name)[0] == '.')
+		{
+			continue;
+		}
+		Record fields;
+		if (!entry_fields(listing, fd, entry->d_name, entry->d_type, &fields))
+		{
+			complete = false;
+			continue;
+		}
+		if (listed != NULL && complete)
+		{
+			complete = dir_cache_add(listed, &fields, entry->d_name);
+		}
+		if (!sorter_add(&sorter, &fields, entry->d_name))
+		{
+			complete = false;
+			break;
+		}
+	}
+	closedir(dir);
+	dir_cache_end(listed, complete);
+
+	sorter_finish(&sorter, print_entry, listing);
+	sorter_free(&sorter);
+}
+
+
+// Each directory of a recursive listing gets its own sorter
+static bool listing_enter(Walker *walker, Walk_dir *dir)
+{
+	Listing *listing = walker->context;
+	Sorter *sorter = malloc(sizeof(Sorter));
+	if (sorter == NULL)
+	{
+		fprintf(command_output(), "Error: Memory allocation failed\n");
+		return false;
+	}
+	// The threads share the memory budget
+	sorter_init(sorter, listing->compare, listing->budget / walker->threads);
+	dir->data = sorter;
+	return true;
+}
+
+static bool listing_visit(Walker *walker, Walk_dir *dir, const char *name, unsigned char type)
+{
+	Listing *listing = walker->context;
+	if (!listing->invisible && name[0] == '.')
+	{
+		return false;
+	}
+	add_entry(dir->data, listing, dir->fd, name, type);
+	return true;
+}
+
+static void listing_scanned(Walker *walker, Walk_dir *dir)
+{
+	Listing *listing = walker->context;
+	Sorter *sorter = dir->data;
+
+	// The directory is displayed at once, from a buffer
+	Listing local = *listing;
+	char *text = NULL;
+	size_t length = 0;
+	local.out = open_memstream(&text, &length);
+	if (local.out != NULL)
+	{
+		local.flag = false;
+		fprintf(local.out, "%s:\n", dir->path);
+		sorter_finish(sorter, print_entry, &local);
+		fputc('\n', local.out);
+		fclose(local.out);
+		output_add(listing->output, dir->path, text, length);
+	}
+	sorter_free(sorter);
+	free(sorter);
+	dir->data = NULL;
+}
+
+
+// Display a directory and all of its subdirectories
+static void list_recursive(const char *path, Listing *listing)
+{
+	Walker walker = {
+		.threads = listing->threads,
+		.enter = listing_enter,
+		.visit = listing_visit,
+		.scanned = listing_scanned,
+		.context = listing,
+	};
+	fflush(listing->out);
+	walk(&walker, cwd.fd, path);
+	if (listing->output->ordered)
+	{
+		output_flush(listing->output);
+	}
 }
 
 
-void ls(Token *head, int argc)
+void ls(int argc, char **argv)
 {
-	bool invisible = false, details = false, flag = false;
+	Output output = {.lock = PTHREAD_MUTEX_INITIALIZER, .out = command_output()};
+	Listing listing = {
+		.compare = compare_name,
+		.budget = SORT_BUDGET,
+		.out = output.out,
+		.output = &output,
+	};
+	bool recursive = false;
+	int operands = 0;
+	char *value = NULL;
+
+	if (!take_threads(&argc, argv, &listing.threads) || !take_value(&argc, argv, "-m", &value))
+	{
+		return;
+	}
+	if (value != NULL)
+	{
+		char *end;
+		errno = 0;
+		unsigned long long kibibytes = strtoull(value, &end, 10);
+		if (*value == '\0' || *end != '\0' || value[0] == '-' || errno != 0 || kibibytes == 0
+			|| kibibytes > SIZE_MAX / 1024)
+		{
+			fprintf(command_output(), "Error: '%s': Invalid memory budget\n", value);
+			return;
+		}
+		listing.budget = kibibytes * 1024;
+	}
 
 	for (int i = 1; i < argc; i++)
 	{
-		char *argument = get_argv(head, i);
+		char *argument = argv[i];
 		if (is_option(argument))
 		{
 			for (int j = 1; j < (int) strlen(argument); j++)
@@ -50,141 +527,354 @@ void ls(Token *head, int argc)
 				switch (argument[j])
 				{
 					case 'l':
-						details = true;
+						listing.details = true;
 						break;
 					case 'a':
-						invisible = true;
+						listing.invisible = true;
+						break;
+					case 'S':
+						listing.compare = compare_size;
+						break;
+					case 't':
+						listing.compare = compare_mtime;
+						break;
+					case 'R':
+						recursive = true;
+						break;
+					case 'D':
+						output.ordered = true;
 						break;
 				}
 			}
 		}
+		else
+		{
+			operands++;
+		}
 	}
 
-	DIR *dir = opendir("./");
-	if (dir == NULL)
+	if (listing.details)
 	{
-		printf("Error: Cannot open directory\n");
-		return;
+		listing.mask |= STATX_MODE | STATX_SIZE;
+	}
+	if (listing.compare == compare_size)
+	{
+		listing.mask |= STATX_SIZE;
+	}
+	else if (listing.compare == compare_mtime)
+	{
+		listing.mask |= STATX_MTIME;
 	}
 
-	struct dirent *entry = readdir(dir);
-	if (entry == NULL)
+	// Without operand, the working directory is displayed
+	if (operands == 0)
 	{
-		printf("Error: Cannot read directory\n");
+		if (recursive)
+		{
+			list_recursive(".", &listing);
+		}
+		else
+		{
+			list_directory(".", &listing);
+		}
 		return;
 	}
 
-	struct stat buf;
-	while (entry != NULL)
+	for (int i = 1; i < argc; i++)
 	{
-		if (!invisible && (entry->d_name)[0] == '.')
+		if (is_option(argv[i]))
 		{
-			entry = readdir(dir);
 			continue;
 		}
+		if (recursive)
+		{
+			list_recursive(argv[i], &listing);
+			continue;
+		}
+		// Name each directory when there are several of them
+		if (operands > 1)
+		{
+			fprintf(listing.out, "%s:\n", argv[i]);
+		}
+		list_directory(argv[i], &listing);
+	}
+}
+
+
+/**
+ * @brief @struct type for the options of 'find'.
+*/
+typedef struct search
+{
+	const char *pattern;
+	Output output;
+} Search;
 
-		if (details)
+
+// Each directory gathers its matches in a buffer
+typedef struct matches
+{
+	FILE *stream;
+	char *text;
+	size_t length;
+} Matches;
+
+
+static bool search_enter(Walker *walker, Walk_dir *dir)
+{
+	(void) walker;
+	Matches *matches = calloc(1, sizeof(Matches));
+	if (matches == NULL)
+	{
+		fprintf(command_output(), "Error: Memory allocation failed\n");
+		return false;
+	}
+	matches->stream = open_memstream(&matches->text, &matches->length);
+	if (matches->stream == NULL)
+	{
+		free(matches);
+		fprintf(command_output(), "Error: Memory allocation failed\n");
+		return false;
+	}
+	dir->data = matches;
+	return true;
+}
+
+static bool search_visit(Walker *walker, Walk_dir *dir, const char *name, unsigned char type)
+{
+	(void) type;
+	Search *search = walker->context;
+	if (search->pattern == NULL || !fnmatch(search->pattern, name, 0))
+	{
+		Matches *matches = dir->data;
+		size_t length = strlen(dir->path);
+		bool slash = length > 0 && dir->path[length - 1] == '/';
+		fprintf(matches->stream, slash ? "%s%s\n" : "%s/%s\n", dir->path, name);
+	}
+	return true;
+}
+
+static void search_scanned(Walker *walker, Walk_dir *dir)
+{
+	Search *search = walker->context;
+	Matches *matches = dir->data;
+	fclose(matches->stream);
+	output_add(&search->output, dir->path, matches->text, matches->length);
+	free(matches);
+	dir->data = NULL;
+}
+
+
+// Search a directory tree, starting point included
+static void search_tree(const char *path, Walker *walker)
+{
+	Search *search = walker->context;
+
+	const char *base = strrchr(path, '/');
+	base = base && base[1] ? base + 1 : path;
+	if (search->pattern == NULL || !fnmatch(search->pattern, base, 0))
+	{
+		fprintf(search->output.out, "%s\n", path);
+	}
+	fflush(search->output.out);
+
+	walk(walker, cwd.fd, path);
+	if (search->output.ordered)
+	{
+		output_flush(&search->output);
+	}
+}
+
+
+void find(int argc, char **argv)
+{
+	Search search = {.output = {.lock = PTHREAD_MUTEX_INITIALIZER, .out = command_output()}};
+	char *pattern = NULL;
+	int threads;
+
+	if (!take_value(&argc, argv, "-name", &pattern) || !take_threads(&argc, argv, &threads))
+	{
+		return;
+	}
+	search.pattern = pattern;
+
+	int operands = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-D"))
 		{
-			// Flag to display header once only
-			if (!flag)
-			{
-				printf("mode\t\tsize\tname\n");
-				flag = true;
-			}
-			/// @note More information could be displayed
-			stat(entry->d_name, &buf);
-			printf("%c%c%c%c%c%c%c%c%c\t",
-				(S_ISDIR(buf.st_mode)) ? 'd' : '-',
-				(buf.st_mode & S_IRUSR) ? 'r' : '-',
-				(buf.st_mode & S_IWUSR) ? 'w' : '-',
-				(buf.st_mode & S_IXUSR) ? 'x' : '-',
-				(buf.st_mode & S_IRGRP) ? 'r' : '-',
-				(buf.st_mode & S_IWGRP) ? 'w' : '-',
-				(buf.st_mode & S_IXGRP) ? 'x' : '-',
-				(buf.st_mode & S_IROTH) ? 'r' : '-',
-				(buf.st_mode & S_IWOTH) ? 'w' : '-');
-			printf("%li\t", buf.st_size);
-		}
-		printf("%s\n", entry->d_name);
-		entry = readdir(dir);
-    }
-	closedir(dir);
+			search.output.ordered = true;
+		}
+		else if (is_option(argv[i]))
+		{
+			fprintf(command_output(), "Error: '%s': Invalid option\n", argv[i]);
+			return;
+		}
+		else
+		{
+			operands++;
+		}
+	}
+
+	Walker walker = {
+		.threads = threads,
+		.enter = search_enter,
+		.visit = search_visit,
+		.scanned = search_scanned,
+		.context = &search,
+	};
+
+	// Without operand, the working directory is searched
+	if (operands == 0)
+	{
+		search_tree(".", &walker);
+		return;
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		if (!is_option(argv[i]))
+		{
+			search_tree(argv[i], &walker);
+		}
+	}
+}
+
+
+void du(int argc, char **argv)
+{
+	char *value = NULL;
+	int threads, depth = -1;
+
+	if (!take_value(&argc, argv, "-d", &value) || !take_threads(&argc, argv, &threads))
+	{
+		return;
+	}
+	if (value != NULL)
+	{
+		char *end;
+		long parsed = strtol(value, &end, 10);
+		if (*value == '\0' || *end != '\0' || parsed < 0 || parsed > INT_MAX)
+		{
+			fprintf(command_output(), "Error: '%s': Invalid depth\n", value);
+			return;
+		}
+		depth = parsed;
+	}
+
+	int operands = 0;
+	bool cached = false;
+	for (int i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "-s"))
+		{
+			depth = 0;
+		}
+		else if (!strcmp(argv[i], "-c"))
+		{
+			cached = true;
+		}
+		else if (is_option(argv[i]))
+		{
+			fprintf(command_output(), "Error: '%s': Invalid option\n", argv[i]);
+			return;
+		}
+		else
+		{
+			operands++;
+		}
+	}
+
+	// Without operand, the working directory is measured
+	FILE *out = command_output();
+	if (operands == 0)
+	{
+		disk_usage(cwd.fd, ".", threads, depth, cached, out);
+		return;
+	}
+	for (int i = 1; i < argc; i++)
+	{
+		if (!is_option(argv[i]))
+		{
+			disk_usage(cwd.fd, argv[i], threads, depth, cached, out);
+		}
+	}
+}
+
+
+void cd(int argc, char **argv)
+{
+	// The number of arguments is checked against the registry
+	(void) argc;
+
+	char *path = argv[1];
+
+	// Absolute paths are opened as is, others relative to the current directory
+	if (!change_directory(path))
+	{
+		fprintf(stderr, "Error: %s: ", path);
+		perror("");
+		return;
+	}
 }
 
 
-void cd(Token *head, int argc)
+/**
+ * Run the same operation on many files at once, and report the files
+ * it failed on. Every file is attempted, whatever the errors met.
+*/
+static void batch_files(Batch_op op, char **paths, int count, mode_t mode, const char *action)
 {
-	if (argc < 2)
+	int *results = arena_alloc(&line_arena, count * sizeof(int));
+	if (results == NULL)
 	{
-		printf("Error: Missing operand\n");
+		fprintf(command_output(), "Error: Memory allocation failed\n");
 		return;
 	}
-	else if (argc > 2)
+	if (run_batch(op, cwd.fd, paths, count, mode, results))
 	{
-		printf("Error: Too many arguments\n");
 		return;
 	}
-
-	char *path = get_argv(head, 1);
-
-	// If an absolute path is given
-	if (path[0] == '/')
-	{
-		if (chdir(path))
-		{
-			perror("Error: chdir()");
-			return;
-		}
-	}
-	else
+	for (int i = 0; i < count; i++)
 	{
-		char new_path[PATH_MAX] = {0};
-		snprintf(new_path, sizeof(new_path), "./%s", path);
-		if (chdir(new_path))
+		if (results[i] != 0)
 		{
-			fprintf(stderr, "Error: %s: ", path);
+			errno = -results[i];
+			fprintf(stderr, "Error: Failed to %s '%s': ", action, paths[i]);
 			perror("");
-			return;
 		}
 	}
 }
 
 
-void touch(Token *head, int argc)
+void touch(int argc, char **argv)
 {
-	if (argc < 2)
-	{
-		printf("Error: Missing operand\n");
-		return;
-	}
-	for (int i = 1; i < argc; i++)
-	{
-		/**
-		 * Set default rights to:
-		 * 	user read:		on
-		 * 	user write:		on
-		 * 	user execute:	on
-		 * 	group read:		on
-		 * 	others read:	on
-		*/
-		creat(get_argv(head, i), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IROTH);
-	}
+	/**
+	 * Set default rights to:
+	 * 	user read:		on
+	 * 	user write:		on
+	 * 	user execute:	on
+	 * 	group read:		on
+	 * 	others read:	on
+	 * Existing files are left as they are.
+	*/
+	batch_files(BATCH_CREATE, argv + 1, argc - 1, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IROTH, "create");
 }
 
 
-void rm(Token *head, int argc)
+void rm(int argc, char **argv)
 {
 	bool confirmation = false, directory = false, remove_all = false;
+	int threads;
 
-	if (argc < 2)
+	if (!take_threads(&argc, argv, &threads))
 	{
-		printf("Error: Missing operand\n");
 		return;
 	}
+
 	// Check options
 	for (int i = 1; i < argc; i++)
 	{
-		char *argument = get_argv(head, i);
+		char *argument = argv[i];
 		if (is_option(argument))
 		{
 			for (int j = 1; j < (int) strlen(argument); j++)
@@ -201,7 +891,7 @@ void rm(Token *head, int argc)
 						remove_all = true;
 						break;
 					default:
-						printf("Error: '%s': Invalid option\n", argument);
+						fprintf(command_output(), "Error: '%s': Invalid option\n", argument);
 						return;
 				}
 			}
@@ -212,296 +902,645 @@ void rm(Token *head, int argc)
 	{
 		for (int i = 1; i < argc; i++)
 		{
-			char *argument = get_argv(head, i);
+			char *argument = argv[i];
 			if (!is_option(argument))
 			{
-				printf("Warning: Remove \t'%s'?\n", argument);
+				fprintf(command_output(), "Warning: Remove \t'%s'?\n", argument);
+
+				// The answer is read over the command line's buffer
+				size_t size = strlen(argument) + 1;
+				argv[i] = arena_alloc(&line_arena, size);
+				if (argv[i] == NULL)
+				{
+					fprintf(command_output(), "Error: Memory allocation failed\n");
+					return;
+				}
+				memcpy(argv[i], argument, size);
 			}
 		}
-		printf("->[y/N] ");
+		fprintf(command_output(), "->[y/N] ");
+		fflush(stdout);
 		// Wait for confirmation
-		if (getchar() != 'y')
+		char *answer = NULL;
+		if (!get_input(&stdin_reader, &answer) || answer[0] != 'y')
 		{
 			return;
 		}
 	}
 
+	// Gather the operands, so that they are removed together
+	char **operands = arena_alloc(&line_arena, argc * sizeof(char *));
+	if (operands == NULL)
+	{
+		fprintf(command_output(), "Error: Memory allocation failed\n");
+		return;
+	}
+	int count = 0;
 	for (int i = 1; i < argc; i++)
 	{
-		char *argument = get_argv(head, i);
-		if (!is_option(argument))
+		if (!is_option(argv[i]))
 		{
-			char path[PATH_MAX] = {0};
-			snprintf(path, sizeof(path), "./%s", argument);
+			operands[count++] = argv[i];
+		}
+	}
 
-			if (remove_all)
-			{
-				recursive_deletion(path);
-				continue;
-			}
+	if (remove_all)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			remove_tree(cwd.fd, operands[i], threads);
+		}
+		return;
+	}
+	batch_files(directory ? BATCH_RMDIR : BATCH_UNLINK, operands, count, 0, "remove");
+}
 
-			if (directory)
-			{
-				if (rmdir(path) == -1)
-				{
-					fprintf(stderr, "Error: Failed to remove '%s': ", argument);
-					perror("");
-					return;
-				}
-				continue;
-			}
 
-			if (unlink(argument) == -1)
-			{
-				fprintf(stderr, "Error: Failed to remove '%s': ", argument);
-				perror("");
-				return;
-			}
-		}
+void mkdir_cli(int argc, char **argv)
+{
+	// Create folders given as argument
+	batch_files(BATCH_MKDIR, argv + 1, argc - 1, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IROTH, "create");
+}
+
+
+void rmdir_cli(int argc, char **argv)
+{
+	// Remove folders given as argument
+	batch_files(BATCH_RMDIR, argv + 1, argc - 1, 0, "remove");
+}
+
+
+/**
+ * Get the path of a source once moved or copied into a directory: its
+ * last component, trailing slashes left out, appended to the directory.
+*/
+static char *path_into(const char *directory, const char *source)
+{
+	size_t end = strlen(source);
+	while (end > 1 && source[end - 1] == '/')
+	{
+		end--;
+	}
+	size_t start = end;
+	while (start > 0 && source[start - 1] != '/')
+	{
+		start--;
+	}
+
+	size_t length = strlen(directory);
+	char *path = arena_alloc(&line_arena, length + end - start + 2);
+	if (path == NULL)
+	{
+		fprintf(command_output(), "Error: Memory allocation failed\n");
+		return NULL;
+	}
+	memcpy(path, directory, length);
+	path[length] = '/';
+	memcpy(path + length + 1, source + start, end - start);
+	path[length + 1 + end - start] = '\0';
+	return path;
+}
+
+
+/**
+ * Check the destination of mv or cp, the last of the operands. It must
+ * be a directory when there are several sources.
+*/
+static bool check_target(char *target, int sources, bool *into)
+{
+	struct stat buf;
+	*into = fstatat(cwd.fd, target, &buf, 0) == 0 && S_ISDIR(buf.st_mode);
+	if (sources > 1 && !*into)
+	{
+		fprintf(command_output(), "Error: '%s': Not a directory\n", target);
+		return false;
 	}
+	return true;
 }
 
 
-void mkdir_cli(Token *head, int argc)
+// Move a file or a directory, copying it when it is on another file system
+static void move(const char *source, const char *destination, int threads)
 {
-	if (argc < 2)
+	if (renameat(cwd.fd, source, cwd.fd, destination) == 0)
 	{
-		printf("Error: Missing operand\n");
 		return;
 	}
-	// Create folders given as argument
-	for (int i = 1; i < argc; i++)
+	if (errno != EXDEV)
 	{
-		char path[PATH_MAX] = {0};
-		char *argument = get_argv(head, i);
-		snprintf(path, sizeof(path), "./%s", argument);
-		if (mkdir(path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IROTH) == -1)
-		{
-			fprintf(stderr, "Error: Failed to create '%s': ", argument);
-			perror("");
-			return;
-		}
+		fprintf(stderr, "Error: '%s': ", source);
+		perror("");
+		return;
+	}
+	// The source is only removed once all of it was copied
+	if (copy_tree(cwd.fd, source, cwd.fd, destination, threads, 0))
+	{
+		remove_tree(cwd.fd, source, threads);
 	}
 }
 
 
-void rmdir_cli(Token *head, int argc)
+void mv(int argc, char **argv)
 {
-	if (argc < 2)
+	int threads;
+	if (!take_threads(&argc, argv, &threads))
 	{
-		printf("Error: Missing operand\n");
 		return;
 	}
-	// Remove folders given as argument
-	for (int i = 1; i < argc; i++)
+	if (argc < 3)
+	{
+		fprintf(command_output(), "Error: mv: Missing destination\n");
+		return;
+	}
+
+	// Sources are moved into the destination if it is a directory
+	char *target = argv[argc - 1];
+	bool into;
+	if (!check_target(target, argc - 2, &into))
+	{
+		return;
+	}
+	for (int i = 1; i < argc - 1; i++)
 	{
-		char path[PATH_MAX] = {0};
-		char *argument = get_argv(head, i);
-		snprintf(path, sizeof(path), "./%s", argument);
-		if (rmdir(path) == -1)
+		char *destination = into ? path_into(target, argv[i]) : target;
+		if (destination == NULL)
 		{
-			fprintf(stderr, "Error: Failed to remove '%s': ", argument);
-			perror("");
 			return;
 		}
+		move(argv[i], destination, threads);
 	}
 }
 
 
-void mv(Token *head, int argc)
+void cp(int argc, char **argv)
 {
-	if (argc < 3)
+	bool recursive = false;
+	int threads, depth = 0;
+	char *value = NULL;
+
+	if (!take_threads(&argc, argv, &threads) || !take_value(&argc, argv, "-q", &value))
+	{
+		return;
+	}
+	if (value != NULL)
 	{
-		printf("Error: Missing operand\n");
+		depth = atoi(value);
+		if (depth < 1)
+		{
+			fprintf(command_output(), "Error: '%s': Invalid queue depth\n", value);
+			return;
+		}
+	}
+
+	// Check options and gather the operands
+	char **operands = arena_alloc(&line_arena, argc * sizeof(char *));
+	if (operands == NULL)
+	{
+		fprintf(command_output(), "Error: Memory allocation failed\n");
 		return;
 	}
-	else if (argc > 3)
+	int count = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		char *argument = argv[i];
+		if (!is_option(argument))
+		{
+			operands[count++] = argument;
+			continue;
+		}
+		for (int j = 1; argument[j] != '\0'; j++)
+		{
+			if (argument[j] != 'r')
+			{
+				fprintf(command_output(), "Error: '%s': Invalid option\n", argument);
+				return;
+			}
+			recursive = true;
+		}
+	}
+	if (count < 2)
 	{
-		printf("Error: Too many arguments\n");
+		fprintf(command_output(), "Error: cp: Missing destination\n");
 		return;
 	}
-	
-	char *old_name = get_argv(head, 1);
-	char *new_name = get_argv(head, 2);
 
-	if(rename(old_name, new_name))
+	// Sources are copied into the destination if it is a directory
+	char *target = operands[count - 1];
+	bool into;
+	if (!check_target(target, count - 1, &into))
 	{
-		fprintf(stderr, "Error: '%s': ", old_name);
-		perror("");
 		return;
 	}
+	for (int i = 0; i < count - 1; i++)
+	{
+		char *source = operands[i];
+		char *destination = into ? path_into(target, source) : target;
+		if (destination == NULL)
+		{
+			return;
+		}
+
+		if (recursive)
+		{
+			copy_tree(cwd.fd, source, cwd.fd, destination, threads, depth);
+			continue;
+		}
+		struct stat buf;
+		if (fstatat(cwd.fd, source, &buf, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(buf.st_mode))
+		{
+			fprintf(command_output(), "Error: '%s': Is a directory, -r is required\n", source);
+			continue;
+		}
+		if (!copy_file(cwd.fd, source, cwd.fd, destination))
+		{
+			fprintf(stderr, "Error: Failed to copy '%s': ", source);
+			perror("");
+		}
+	}
+}
+
+
+// Open a file to display, and ask the kernel to start reading it ahead
+static int open_sequential(const char *path)
+{
+	int fd = openat(cwd.fd, path, O_RDONLY | O_CLOEXEC);
+	if (fd != -1)
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	}
+	return fd;
 }
 
 
-void cat(Token *head, int argc)
+void cat(int argc, char **argv)
 {
-	if (argc < 2)
+	// Data already buffered by stdio must come first
+	FILE *out = command_output();
+	fflush(out);
+
+	/**
+	 * Without operand, the output of the previous stage of a pipeline is
+	 * displayed. The standard input of the shell holds the next command
+	 * lines: it is not read.
+	*/
+	if (argc == 1)
 	{
-		printf("Error: Missing operand\n");
+		if (streams.in == STDIN_FILENO)
+		{
+			fprintf(command_output(), "Error: Missing operand\n");
+			return;
+		}
+		if (!transfer_data(streams.in, fileno(out)) && errno != EPIPE)
+		{
+			fprintf(command_output(), "Error: Could not write to standard output\n");
+		}
 		return;
 	}
 
-	for (int i = 1; i < argc; i++)
+	// The next file is opened, and prefetched, while the current one is sent
+	int next = open_sequential(argv[1]);
+	int i;
+	for (i = 1; i < argc; i++)
 	{
-		char *argument = get_argv(head, i);
+		int fd = next;
+		if (i + 1 < argc)
+		{
+			next = open_sequential(argv[i + 1]);
+		}
 
-		FILE *file = fopen(argument, "r");
-		if (file == NULL)
+		if (fd == -1)
 		{
-			printf("Error: Could not open %s\n", argument);
-			return;
+			fprintf(command_output(), "Error: Could not open %s\n", argv[i]);
+			break;
 		}
 
-		// Transfer data from stream to stdout
-		char character = '\0';
-		while((character = fgetc(file)) != EOF)
+		// Transfer data from the file to the output, a reader gone stopping it silently
+		bool sent = transfer_data(fd, fileno(out));
+		close(fd);
+		if (!sent)
 		{
-			if (putchar(character) == EOF)
+			if (errno != EPIPE)
 			{
-				printf("Error: Could not write to standard output\n");
-				fclose(file);
-				return;
+				fprintf(command_output(), "Error: Could not write to standard output\n");
 			}
+			break;
 		}
-		putchar('\n');
-		fclose(file);
+		fputc('\n', out);
+		fflush(out);
+	}
+
+	// Close the file prefetched if the loop was left early
+	if (i + 1 < argc && next != -1)
+	{
+		close(next);
 	}
 }
 
 
-void make(Token *head, int argc)
+void make(int argc, char **argv)
 {
-	if (argc < 2)
+	int jobs;
+	if (!take_threads(&argc, argv, &jobs))
 	{
-		printf("Error: Missing operand\n");
 		return;
 	}
 
-	char *extension = malloc(SIZE_INPUT * sizeof(char));
-	if (extension == NULL)
+	char **sources = arena_alloc(&line_arena, argc * sizeof(char *));
+	if (sources == NULL)
 	{
-		printf("Error: Memory allocation failed\n");
+		fprintf(command_output(), "Error: Memory allocation failed\n");
 		return;
 	}
-
-	// Compile each source file
+	int count = 0;
 	for (int i = 1; i < argc; i++)
 	{
-		memset(extension, 0, SIZE_INPUT);
-		/**
-		 * This pointer will be dynamic. It will help store each
-		 * character of the extension while not losing the original
-		 * adress.
-		*/
-		char *ptr = extension;
-
-		bool ext_exist = false;
-		char name[SIZE_INPUT] = {0};
+		char *full_name = argv[i];
 
-		char *full_name = get_argv(head, i);
-		int full_name_len = (int) strlen(full_name);
-		
 		// Check if .c file
-		for (int j = 0; j < full_name_len; j++)
+		char *extension = strrchr(full_name, '.');
+		if (extension == NULL || strcmp(extension, ".c"))
 		{
-			if (full_name[j] == '.' || ext_exist)
-			{
-				ext_exist = true;
-				*ptr = full_name[j];
-				ptr++;
-			}
-			else
-			{
-				// Get the file name only (will be the executable's name)
-				name[j] = full_name[j];
-			}
-		}
-
-		if (strcmp(extension, ".c"))
-		{
-			printf("Error: %s is not a C source file\n", full_name);
+			fprintf(command_output(), "Error: %s is not a C source file\n", full_name);
 			continue;
 		}
+		sources[count++] = full_name;
+	}
+
+	// Each source is the main file of a program named after it
+	build_programs(cwd.fd, sources, count, jobs);
+}
+
+
+pid_t spawn_program(char **argv, int in, int out)
+{
+	// A name without slash is a program of $PATH
+	const char *path = argv[0];
+	if (strchr(path, '/') == NULL && (path = path_lookup(argv[0])) == NULL)
+	{
+		fprintf(command_output(), "Error: %s: Unknown command\n", argv[0]);
+		errno = ENOENT;
+		return -1;
+	}
+
+	/**
+	 * posix_spawn() does not copy the page tables of the shell as
+	 * fork() does, so the launch does not get slower as the shell
+	 * grows. The argument array is the parsed line, NULL-terminated.
+	*/
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attributes;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attributes);
+	if (in != STDIN_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+	}
+	if (out != STDOUT_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+	}
+
+	// SIGPIPE is ignored by the shell, but the program must be stopped by it
+	sigset_t defaults;
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attributes, &defaults);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF);
+
+	pid_t pid;
+	int error = posix_spawn(&pid, path, &actions, &attributes, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attributes);
+	if (error != 0)
+	{
+		errno = error;
+		fprintf(stderr, "Error: %s: ", argv[0]);
+		perror("");
+		errno = error;
+		return -1;
+	}
+	return pid;
+}
 
-		char command[PATH_MAX] = {0};
-		snprintf(command, sizeof(command), "gcc -o %s %s\n", name, full_name);
 
-		if (system(command) == -1)
+int wait_program(pid_t pid, struct rusage *usage)
+{
+	int status;
+	while (wait4(pid, &status, 0, usage) == -1)
+	{
+		if (errno != EINTR)
 		{
-			free(extension);
-			perror("Error: ");
-			return;
+			perror("Error: wait4()");
+			return 1;
 		}
 	}
-	free(extension);
+	if (WIFSIGNALED(status))
+	{
+		return 128 + WTERMSIG(status);
+	}
+	return WEXITSTATUS(status);
 }
 
 
-void run(Token *head, int argc)
+int run(int argc, char **argv, struct rusage *usage)
 {
-	char *command = get_argv(head, 0);
-	if (command == NULL)
+	char *command = argv[0];
+	if (argc < 1 || command == NULL)
 	{
-		printf("Error: Cannot access command\n");
-		return;
+		fprintf(command_output(), "Error: Cannot access command\n");
+		return 127;
 	}
 
-	// Create array of string for command-line arguments
-	char **argv = calloc(argc + 1, sizeof(char *));
-	if (argv == NULL)
+	// Output of the shell so far must come before the one of the program
+	fflush(stdout);
+
+	pid_t pid = spawn_program(argv, STDIN_FILENO, STDOUT_FILENO);
+	if (pid == -1)
 	{
-		printf("Error: Memory allocation failed\n");
-		return;
+		return errno == ENOENT ? 127 : 126;
+	}
+
+	// Wait for the program to complete, along with its resource usage if asked
+	return wait_program(pid, usage);
+}
+
+
+void hash(int argc, char **argv)
+{
+	bool reset = false;
+	for (int i = 1; i < argc; i++)
+	{
+		reset |= !strcmp(argv[i], "-r");
+	}
+	if (reset)
+	{
+		path_forget();
 	}
 
-	// Get command-line arguments
-	for (int i = 0; i < argc; i++)
+	// The names given are looked up right away, the table is displayed otherwise
+	bool names = false;
+	for (int i = 1; i < argc; i++)
 	{
-		argv[i] = (char *) calloc(SIZE_INPUT, 1);
-		if (argv[i] == NULL)
+		if (is_option(argv[i]))
 		{
-			// If memory alloc failed, free all previous memory
-			printf("Error: Memory allocation failed\n");
-			for (int j = 0; j < i; j++)
-			{
-				free(argv[j]);
-			}
-			free(argv);
-			return;
+			continue;
+		}
+		names = true;
+		if (path_lookup(argv[i]) == NULL)
+		{
+			fprintf(command_output(), "Error: %s: Not found\n", argv[i]);
 		}
-		strcpy(argv[i], get_argv(head, i));
 	}
-	// Last argument must be NULL for execv() to work
-	argv[argc] = NULL;
+	if (!names && !reset)
+	{
+		path_list(command_output());
+	}
+}
+
+
+void jobs(int argc, char **argv)
+{
+	(void) argc;
+	(void) argv;
+	jobs_list();
+}
 
-	// Run the executable
-	pid_t pid = fork();
-	if (pid < 0)
+
+void wait_cli(int argc, char **argv)
+{
+	int id = 0;
+	if (argc == 2)
+	{
+		// The job ID may be given as '%1', as in other shells
+		const char *value = argv[1][0] == '%' ? argv[1] + 1 : argv[1];
+		id = atoi(value);
+		if (id < 1)
+		{
+			fprintf(command_output(), "Error: '%s': Invalid job ID\n", argv[1]);
+			return;
+		}
+	}
+	if (!jobs_wait(id))
 	{
-		// Forking failed
-		perror("Error: fork: ");
-		exit(EXIT_FAILURE);
+		fprintf(command_output(), "Error: %s: No such job\n", argv[1]);
 	}
-	if (pid == 0)
+}
+
+
+// Slot of a name in the registry: its length and first and last letters
+static unsigned int command_slot(const char *name, size_t length)
+{
+	return (length + 3 * (unsigned char) name[0] + (unsigned char) name[length - 1]) & (COMMAND_SLOTS - 1);
+}
+
+
+/**
+ * Registry of the builtin commands. It is a perfect hash table: each
+ * command sits in the slot command_slot() gives its name, the other
+ * slots being empty. A new command needs a slot no other name uses;
+ * two entries in the same slot make the compiler warn, and
+ * check_registry() reports an entry in the wrong slot at startup.
+*/
+const Command commands[COMMAND_SLOTS] = {
+	// name, handler, min. argc, max. argc, options, alone in a pipeline
+	[5] = {"rm", rm, 2, -1, "idrj", "i"},
+	[9] = {"touch", touch, 2, -1, NULL, NULL},
+	[13] = {"rmdir", rmdir_cli, 2, -1, NULL, NULL},
+	[15] = {"cd", cd, 2, 2, NULL, ""},
+	[26] = {"find", find, 1, -1, NULL, NULL},
+	[27] = {"cp", cp, 3, -1, "rjq", NULL},
+	[29] = {"wait", wait_cli, 1, 2, NULL, ""},
+	[32] = {"cat", cat, 1, -1, NULL, NULL},
+	[34] = {"echo", echo, 1, -1, NULL, NULL},
+	[35] = {"du", du, 1, -1, "sdjc", NULL},
+	[36] = {"hash", hash, 1, -1, "r", NULL},
+	[39] = {"exit", NULL, 1, 1, NULL, ""},
+	[48] = {"make", make, 2, -1, "j", NULL},
+	[53] = {"jobs", jobs, 1, 1, NULL, ""},
+	[55] = {"pwd", pwd, 1, -1, NULL, NULL},
+	[57] = {"ls", ls, 1, -1, "alStRDjm", NULL},
+	[62] = {"mkdir", mkdir_cli, 2, -1, NULL, NULL},
+	[63] = {"mv", mv, 3, -1, "j", NULL},
+};
+const int command_count = COMMAND_SLOTS;
+
+
+bool check_registry(void)
+{
+	bool valid = true;
+	for (int i = 0; i < command_count; i++)
 	{
-		// Child process
-		if (execv(command, argv) == -1)
+		const char *name = commands[i].name;
+		if (name != NULL && command_slot(name, strlen(name)) != (unsigned int) i)
 		{
-			perror("Error: execv: ");
-			exit(EXIT_FAILURE);
+			fprintf(stderr, "Error: registry: '%s' is in slot %d instead of %u\n",
+				name, i, command_slot(name, strlen(name)));
+			valid = false;
 		}
 	}
-	else
+	return valid;
+}
+
+
+const Command *find_command(const char *name)
+{
+	size_t length = strlen(name);
+	if (length == 0)
+	{
+		return NULL;
+	}
+	const Command *command = &commands[command_slot(name, length)];
+	return command->name != NULL && !strcmp(command->name, name) ? command : NULL;
+}
+
+
+bool check_arguments(const Command *command, int argc, char **argv)
+{
+	if (argc < command->min_argc)
+	{
+		fprintf(command_output(), "Error: Missing operand\n");
+		return false;
+	}
+	if (command->max_argc != -1 && argc > command->max_argc)
 	{
-		// Wait for the child process to complete
-		pid = wait(NULL);
+		fprintf(command_output(), "Error: Too many arguments\n");
+		return false;
+	}
+	if (command->options == NULL)
+	{
+		return true;
 	}
 
-	// Free all memory
-	for (int i = 0; i < argc; i++)
+	for (int i = 1; i < argc; i++)
 	{
-		free(argv[i]);
+		if (is_option(argv[i]))
+		{
+			for (int j = 1; argv[i][j] != '\0'; j++)
+			{
+				if (strchr(command->options, argv[i][j]) == NULL)
+				{
+					fprintf(command_output(), "Error: '%s': Invalid option\n", argv[i]);
+					return false;
+				}
+			}
+		}
 	}
-	free(argv);
+	return true;
 }
 
+
+bool check_stage(const Command *command, int argc, char **argv)
+{
+	bool alone = command->alone != NULL && command->alone[0] == '\0';
+	for (int i = 1; i < argc && command->alone != NULL && !alone; i++)
+	{
+		alone = is_option(argv[i]) && strpbrk(argv[i] + 1, command->alone) != NULL;
+	}
+	if (alone)
+	{
+		fprintf(command_output(), "Error: %s: Cannot be part of a pipeline\n", argv[0]);
+		return false;
+	}
+	return true;
+}
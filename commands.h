@@ -3,202 +3,485 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
+#include <sys/resource.h>
+
 #include "utils.h"
 
 
 /**
- * void echo(Token *head, int argc)
+ * @brief @struct type to register a builtin command.
+ * 
+ * Each command is described by its name, the function executing it,
+ * the range of accepted argument counts (the command name included,
+ * -1 meaning no upper limit), and the option letters it accepts.
+ * Options are not checked when @p options is NULL. The 'exit'
+ * command is registered without handler.
+ * 
+ * The stages of a pipeline run on threads sharing the state of the
+ * shell. @p alone is NULL for a command that can be a stage, "" for a
+ * command that changes or reads that state and must run on its own,
+ * or the option letters that make it so.
+*/
+typedef struct command
+{
+	const char *name;
+	void (*handler)(int argc, char **argv);
+	int min_argc;
+	int max_argc;
+	const char *options;
+	const char *alone;
+} Command;
+
+// Slots of the registry, a power of two; the empty ones have no name
+#define COMMAND_SLOTS 64
+
+// Registry of the builtin commands, and its number of slots
+extern const Command commands[];
+extern const int command_count;
+
+
+/**
+ * bool check_registry(void)
+ * @brief Check that each command of the registry is in its slot.
+ * 
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true if every command can be found.
+ * 						false if not, the misplaced ones being displayed.
+*/
+bool check_registry(void);
+
+
+/**
+ * const Command *find_command(const char *name)
+ * @brief Look up a builtin command by name.
+ * 
+ * @param[in] name	Name of the command.
+ * @return			A pointer to the registered command.
+ * @retval			'Command' pointer if the command exists.
+ * 					NULL pointer if not.
+ * 
+ * The function find_command() accepts a character pointer @p name
+ * as input. The registry is a perfect hash table laid out at compile
+ * time: the name is hashed from its length and its first and last
+ * letters, and compared with the single command of that slot.
+*/
+const Command *find_command(const char *name);
+
+
+/**
+ * bool check_arguments(const Command *command, int argc, char **argv)
+ * @brief Check a command line against the registry entry of a command.
+ * 
+ * @param[in] command	Registered command.
+ * @param[in] argc		Number of arguments.
+ * @param[in] argv		Array of arguments.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true if the command line is valid.
+ * 						false if not.
+ * 
+ * The function check_arguments() accepts a pointer @p command , an
+ * integer @p argc and an array @p argv as input. It checks the number
+ * of arguments and the options given, and displays an error message
+ * if they do not match the entry of @p command .
+*/
+bool check_arguments(const Command *command, int argc, char **argv);
+
+
+/**
+ * bool check_stage(const Command *command, int argc, char **argv)
+ * @brief Check that a command line can be a stage of a pipeline.
+ * 
+ * @param[in] command	Registered command.
+ * @param[in] argc		Number of arguments.
+ * @param[in] argv		Array of arguments.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true if the command can run on a thread of its own.
+ * 						false if not, an error message being displayed.
+*/
+bool check_stage(const Command *command, int argc, char **argv);
+
+
+/**
+ * void echo(int argc, char **argv)
  * @brief Display the argument(s) given as input.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function echo() accepts a pointer @p head and an integer 
- * @p argc as input. 
+ * The function echo() accepts an integer @p argc and an array 
+ * @p argv as input. 
  * It displays the arguments following the command. The use of
  * double quotation mark is not required to print text with spaces.
 */
-void echo(Token *head, int argc);
+void echo(int argc, char **argv);
 
 /**
- * void pwd(void)
+ * void pwd(int argc, char **argv)
  * @brief Print the current working directory.
  * 
+ * @param[in] argc	Number of arguments (unused).
+ * @param[in] argv	Array of arguments (unused).
  * @return			Nothing.
  * 
- * The function pwd() takes no input parameter and returns no
+ * The function pwd() ignores its arguments and returns no
  * output. It displays the path of the current working directory
- * on stdout . If the path length is larger than PATH_MAX, an
- * error message is displayed instead if the path length.
+ * on stdout . The path is the one cached in 'cwd' by cd(), so
+ * that no system call is needed.
 */
-void pwd();
+void pwd(int argc, char **argv);
 
 /**
- * void ls(Token *head, int argc)
- * @brief Print the content of the working directory.
+ * void ls(int argc, char **argv)
+ * @brief Print the content of a directory.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function touch() accepts a pointer @p head and an integer 
- * @p argc as input. It displays the content of the current
- * working directory. By default, it does not show hidden files.
- * The function allows the input of 2 options:
+ * The function ls() accepts an integer @p argc and an array 
+ * @p argv as input. It displays the content of the directories
+ * given as arguments, or of the current working directory if
+ * there are none. By default, it does not show hidden files.
+ * Files are only examined, relative to their directory, when
+ * extra data is requested. The entries of a directory listed
+ * without -R are kept in a cache until inotify reports a change.
+ * The entries are sorted by name, within a bounded amount of
+ * memory. The function allows the input of 7 options:
  * 		-a: Enables the display of hidden files.
  * 		-l: Enables the display of extra data.
+ * 		-S: Sorts the entries by decreasing size.
+ * 		-t: Sorts the entries by modification time, newest first.
+ * 		-R: Displays the subdirectories as well, walking the tree
+ * 			with several threads ('-j N' sets their number).
+ * 		-D: Displays the directories of -R in a fixed order.
+ * 		-m <KiB>: Sets the memory used to sort the entries,
+ * 			SORT_BUDGET by default, shared by the threads of -R.
+*/
+void ls(int argc, char **argv);
+
+/**
+ * void find(int argc, char **argv)
+ * @brief Search a directory tree for files.
+ * 
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
+ * @return			Nothing.
+ * 
+ * The function find() accepts an integer @p argc and an array 
+ * @p argv as input. It displays the path of every file found
+ * in the directories given as arguments, or in the current
+ * working directory if there are none. The tree is walked by
+ * several threads. The function allows the input of 3 options:
+ * 		-name <pattern>: Only displays the files whose name
+ * 						matches the shell pattern.
+ * 		-j <number>:	Sets the number of threads.
+ * 		-D:				Displays the directories in a fixed order.
+*/
+void find(int argc, char **argv);
+
+/**
+ * void du(int argc, char **argv)
+ * @brief Display the disk usage of directory trees.
+ * 
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
+ * @return			Nothing.
+ * 
+ * The function du() accepts an integer @p argc and an array
+ * @p argv as input. It displays in kibibytes the blocks used by
+ * each directory of the trees given as arguments, or of the
+ * current working directory if there are none, with
+ * disk_usage(). The trees are walked by several threads. The
+ * function allows the input of 4 options:
+ * 		-s:				Only displays the total of each tree.
+ * 		-d <depth>:		Only displays the directories down to
+ * 						the depth given, at most INT_MAX.
+ * 		-j <number>:	Sets the number of threads.
+ * 		-c:				Keeps the blocks of the files of each
+ * 						directory in a cache file of the home
+ * 						directory, so that the files of the
+ * 						directories left unchanged are not
+ * 						examined on the next run with -c. The
+ * 						cache is neither read nor written
+ * 						without this option.
 */
-void ls(Token *head, int argc);
+void du(int argc, char **argv);
 
 /**
- * void cd(Token *head, int argc)
+ * void cd(int argc, char **argv)
  * @brief Change the current working directory.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function cd() accepts a pointer @p head and an integer 
- * @p argc as input. It changes the current working directory
- * to the one embedded in the second token. Both absolute and
- * relative path can be given. An error message is displayed
+ * The function cd() accepts an integer @p argc and an array 
+ * @p argv as input. It changes the current working directory
+ * to the one given as second argument. Both absolute and
+ * relative path can be given. The new directory is opened
+ * relative to 'cwd' with change_directory(), which also caches
+ * its canonical path. An error message is displayed
  * if the desired working directory does not exist or is
  * unreachable. 
 */
-void cd(Token *head, int argc);
+void cd(int argc, char **argv);
 
 /**
- * void touch(Token *head, int argc)
+ * void touch(int argc, char **argv)
  * @brief Create one or multiple files.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function touch() accepts a pointer @p head and an integer 
- * @p argc as input. It creates as many files as given arguments
+ * The function touch() accepts an integer @p argc and an array 
+ * @p argv as input. It creates as many files as given arguments
  * in the current working directory. The function also sets the 
  * file(s) as read and write for 'user', and read only for
- * 'group' and 'others'.
+ * 'group' and 'others'. Existing files are not truncated. The
+ * files are created together with run_batch().
 */
-void touch(Token *head, int argc);
+void touch(int argc, char **argv);
 
 /**
- * void rm(Token *head, int argc)
+ * void rm(int argc, char **argv)
  * @brief Remove files or folders.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function rm() accepts a pointer @p head and an integer 
- * @p argc as input. By default, it removes file(s) from the 
+ * The function rm() accepts an integer @p argc and an array 
+ * @p argv as input. By default, it removes file(s) from the 
  * directory structure without confirmation prompt. It also
  * accepts different options as input:
  * 		-d: Enables the deletion of empty directories.
  * 		-i: Enables a confirmation prompt before deletion.
- * 		-r: Enables to deletion of a folder and its content.
- * An error message is instead displayed on stderr if the file
- * or folder does not exist.
+ * 		-r: Enables to deletion of a folder and its content,
+ * 			with several threads ('-j N' sets their number).
+ * An error message is instead displayed on stderr for each file
+ * or folder that does not exist, the others being removed anyway.
+ * Without -r, the operands are removed together with run_batch().
 */
-void rm(Token *head, int argc);
+void rm(int argc, char **argv);
 
 /**
- * void mkdir_cli(Token *head, int argc)
+ * void mkdir_cli(int argc, char **argv)
  * @brief Create an empty folder.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function mkdir_cli() accepts a pointer @p head and 
- * an integer @p argc as input. It creates an empty folder
- * from the current directory. An error message is instead
- * displayed on stderr if the folder cannot be created.
+ * The function mkdir_cli() accepts an integer @p argc and 
+ * an array @p argv as input. It creates an empty folder
+ * from the current directory for each argument, all of them
+ * together with run_batch(). An error message is instead
+ * displayed on stderr for each folder that cannot be created.
 */
-void mkdir_cli(Token *head, int argc);
+void mkdir_cli(int argc, char **argv);
 
 /**
- * void rmdir_cli(Token *head, int argc)
+ * void rmdir_cli(int argc, char **argv)
  * @brief Remove an empty folder.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function rmdir_cli() accepts a pointer @p head and 
- * an integer @p argc as input. It removes empty-only folders
- * from the current directory. An error message is instead
- * displayed on stderr if the given folder does not exist or
- * is not empty.
+ * The function rmdir_cli() accepts an integer @p argc and 
+ * an array @p argv as input. It removes empty-only folders
+ * from the current directory, all of them together with
+ * run_batch(). An error message is instead displayed on stderr
+ * for each folder that does not exist or is not empty.
 */
-void rmdir_cli(Token *head, int argc);
+void rmdir_cli(int argc, char **argv);
 
 /**
- * void mv(Token *head, int argc)
+ * void mv(int argc, char **argv)
  * @brief Rename a file or change its location.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function mv() accepts a pointer @p head and an integer
- * @p argc as input. It will either rename or move the 
+ * The function mv() accepts an integer @p argc and an array
+ * @p argv as input. It will either rename or move the 
  * location of a file depending on the arguments found in the
- * linked list. mv() makes use of the function rename() from
- * <stdio.h> to execute the command and ensure error handling.
+ * argument array. When the last argument is a directory, all the
+ * other ones are moved into it. mv() makes use of the function
+ * renameat() to execute the command and ensure error handling.
+ * Across file systems, the file or folder is copied with
+ * copy_tree() and then removed, with several threads ('-j N'
+ * sets their number).
+*/
+void mv(int argc, char **argv);
+
+/**
+ * void cp(int argc, char **argv)
+ * @brief Copy files or folders.
+ * 
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
+ * @return			Nothing.
+ * 
+ * The function cp() accepts an integer @p argc and an array
+ * @p argv as input. It copies the file given as first argument
+ * to the second one, or all the files given into the last
+ * argument when it is a directory. The data is copied by the
+ * kernel with copy_file(), holes in sparse files being kept.
+ * The function allows the input of 3 options:
+ * 		-r:				Enables the copy of folders and their content,
+ * 						walking the tree with several threads.
+ * 		-j <number>:	Sets the number of threads.
+ * 		-q <number>:	Sets the number of files copied at once.
 */
-void mv(Token *head, int argc);
+void cp(int argc, char **argv);
 
 /**
- * void cat(Token *head, int argc)
+ * void cat(int argc, char **argv)
  * @brief Display the content of a file.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function cat() accepts a pointer @p head and an integer
- * @p argc as input. It displays the content of a file on the
- * standard output. Several filenames can be given as arguments.
- * An error message is instead displayed if the file cannot be
- * found or open.
+ * The function cat() accepts an integer @p argc and an array
+ * @p argv as input. It displays the content of a file on the
+ * standard output. Several filenames can be given as arguments,
+ * each file being prefetched while the previous one is displayed.
+ * Without argument, the standard input is displayed instead, such
+ * as the output of the previous command of a pipeline. The data is
+ * copied by the kernel whenever possible. An error message is
+ * instead displayed if the file cannot be found or open.
 */
-void cat(Token *head, int argc);
+void cat(int argc, char **argv);
 
 /**
- * void make(Token *head, int argc)
+ * void make(int argc, char **argv)
  * @brief Create the executable of a .c source file.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
  * @return			Nothing.
  * 
- * The function make() accepts a pointer @p head and an integer
- * @p argc as input. It compiles a source code file in c language
- * using the GCC compiler and creates the executable. Several
- * source code files can be given as arguments, as long as they're
- * in c language.
+ * The function make() accepts an integer @p argc and an array
+ * @p argv as input. It builds a program from each source code
+ * file in c language given as argument, using the GCC compiler,
+ * with build_programs(). The sources next to the local headers a
+ * program includes are compiled and linked into it, and only the
+ * objects older than their files are compiled again. The
+ * compilers are launched directly with posix_spawnp(), up to one
+ * per processor at once ('-j N' sets their number), and the
+ * outcome and duration of each step are displayed once all of
+ * them ended. Programs are kept in a build cache of the working
+ * directory, keyed by a hash of all of their files: a program
+ * whose files did not change is not built again, its executable
+ * being left as is or restored from the cache. The hits and
+ * misses of the cache are displayed.
 */
-void make(Token *head, int argc);
+void make(int argc, char **argv);
 
 /**
- * void run(Token *head, int argc)
+ * int run(int argc, char **argv, struct rusage *usage)
  * @brief Execute a program file.
  * 
- * @param[in] head	Memory area where the parsed data is.
  * @param[in] argc	Number of arguments.
- * @return			Nothing.
+ * @param[in] argv	Array of arguments.
+ * @param[out] usage	Resources used by the program, or NULL.
+ * @return			Exit status of the program.
+ * @retval			Status given by the program to exit().
+ * 					128 plus the number of the signal that killed it.
+ * 					126 or 127 if it could not be launched.
  * 
- * The function run() accepts a pointer @p head and an integer
- * @p argc as input. It runs a program file as long as the file
+ * The function run() accepts an integer @p argc and an array
+ * @p argv as input. It runs a program file as long as the file
  * is an executable. The function use the first argument as path
- * to the file, and the other arguments, if any, as arguments
- * themselves to the given executable file. After the process is
- * executed, the father process resumes.
+ * to the file, or as the name of a program of $PATH, and the
+ * other arguments, if any, as arguments themselves to the given
+ * executable file. The program is launched with posix_spawn(),
+ * which does not copy the memory of the shell. After the process
+ * is executed, the father process resumes.
+*/
+int run(int argc, char **argv, struct rusage *usage);
+
+/**
+ * pid_t spawn_program(char **argv, int in, int out)
+ * @brief Launch a program file without waiting for it.
+ * 
+ * @param[in] argv	Path of the program and its arguments, NULL-terminated.
+ * @param[in] in	File descriptor given to the program as standard input.
+ * @param[in] out	File descriptor given to the program as standard output.
+ * @return			Process ID of the program.
+ * @retval			-1 if the program could not be launched, errno
+ * 					being set and an error message displayed.
+ * 
+ * A program named without slash is looked for in the directories of
+ * $PATH with path_lookup(). The program is launched with
+ * posix_spawn(), @p in and @p out being duplicated onto its
+ * standard streams. The default action of SIGPIPE,
+ * ignored by the shell, is restored for the program.
+*/
+pid_t spawn_program(char **argv, int in, int out);
+
+/**
+ * int wait_program(pid_t pid, struct rusage *usage)
+ * @brief Wait for a program launched with spawn_program().
+ * 
+ * @param[in] pid		Process ID of the program.
+ * @param[out] usage	Resources used by the program, or NULL.
+ * @return				Exit status of the program, as run() gives it.
+*/
+int wait_program(pid_t pid, struct rusage *usage);
+
+/**
+ * void jobs(int argc, char **argv)
+ * @brief Display the programs running in the background.
+ * 
+ * @param[in] argc	Number of arguments (unused).
+ * @param[in] argv	Array of arguments (unused).
+ * @return			Nothing.
+ * 
+ * The function jobs() displays the ID, process ID, state and command
+ * line of each job started with '&' and not announced as done yet.
+*/
+void jobs(int argc, char **argv);
+
+/**
+ * void hash(int argc, char **argv)
+ * @brief Manage the table of the programs found in $PATH.
+ * 
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
+ * @return			Nothing.
+ * 
+ * The function hash() accepts an integer @p argc and an array
+ * @p argv as input. Without argument, it displays the programs
+ * of the table along with the number of times each was looked up. The
+ * programs named as arguments are looked up and added to the table.
+ * An error message is displayed for those that cannot be found.
+ * Available option:
+ * 		-r: Clears the table, every program being looked for in
+ * 			the directories of $PATH again.
+*/
+void hash(int argc, char **argv);
+
+/**
+ * void wait_cli(int argc, char **argv)
+ * @brief Wait for programs running in the background.
+ * 
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Array of arguments.
+ * @return			Nothing.
+ * 
+ * The function wait_cli() accepts an integer @p argc and an array
+ * @p argv as input. It waits for the job whose ID is given as
+ * argument, or for every job without argument. The jobs waited for
+ * are announced at the next prompt. An error message is displayed
+ * if there is no such job.
 */
-void run(Token *head, int argc);
+void wait_cli(int argc, char **argv);
 
 
 #endif // COMMANDS_H
\ No newline at end of file
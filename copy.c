@@ -0,0 +1,424 @@
+// File copy definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <semaphore.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "copy.h"
+#include "utils.h"
+#include "walker.h"
+
+
+/**
+ * @brief @struct type for the destination of a tree copy.
+*/
+typedef struct copy
+{
+	int to_dirfd;
+	const char *to;
+	// Slots of the files being copied, when their number is bounded
+	sem_t slots;
+	bool bounded;
+} Copy;
+
+
+// Check whether two files are the same one, under any of their names
+static bool same_file(const struct stat *a, const struct stat *b)
+{
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+
+// Copy a range of a file through a buffer, for when the kernel cannot
+static bool copy_buffer(int in, int out, off_t offset, off_t length)
+{
+	char *buffer = malloc(SIZE_COPY);
+	if (buffer == NULL)
+	{
+		return false;
+	}
+	while (length > 0)
+	{
+		ssize_t bytes = pread(in, buffer, length < SIZE_COPY ? length : SIZE_COPY, offset);
+		if (bytes == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (bytes <= 0)
+		{
+			free(buffer);
+			return bytes == 0;
+		}
+		for (ssize_t written = 0; written < bytes; )
+		{
+			ssize_t count = pwrite(out, buffer + written, bytes - written, offset + written);
+			if (count == -1 && errno != EINTR)
+			{
+				free(buffer);
+				return false;
+			}
+			written += count > 0 ? count : 0;
+		}
+		offset += bytes;
+		length -= bytes;
+	}
+	free(buffer);
+	return true;
+}
+
+
+// Copy a range of a file within the kernel
+static bool copy_range(int in, int out, off_t offset, off_t length)
+{
+	loff_t in_offset = offset, out_offset = offset;
+	while (length > 0)
+	{
+		ssize_t bytes = copy_file_range(in, &in_offset, out, &out_offset, length, 0);
+		if (bytes > 0)
+		{
+			length -= bytes;
+			continue;
+		}
+		if (bytes == 0)
+		{
+			// The file got shorter while being copied
+			return true;
+		}
+		if (errno == EINTR)
+		{
+			continue;
+		}
+		if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)
+		{
+			return copy_buffer(in, out, in_offset, length);
+		}
+		return false;
+	}
+	return true;
+}
+
+
+// Copy the parts of a file holding data, leaving its holes as holes
+static bool copy_data(int in, int out, off_t size)
+{
+	off_t offset = 0;
+	while (offset < size)
+	{
+		off_t data = lseek(in, offset, SEEK_DATA);
+		off_t hole = size;
+		if (data == -1)
+		{
+			if (errno == ENXIO)
+			{
+				// Only a hole is left
+				break;
+			}
+			// Holes are not reported by this file system
+			data = offset;
+		}
+		else
+		{
+			hole = lseek(in, data, SEEK_HOLE);
+			if (hole == -1 || hole > size)
+			{
+				hole = size;
+			}
+		}
+		if (!copy_range(in, out, data, hole - data))
+		{
+			return false;
+		}
+		offset = hole;
+	}
+	// A hole at the end of the file is only made by its size
+	return ftruncate(out, size) == 0;
+}
+
+
+// Copy a symbolic link, the path it holds being kept as is
+static bool copy_link(int from_dirfd, const char *from, int to_dirfd, const char *to, const struct stat *buf)
+{
+	char target[PATH_MAX];
+	ssize_t length = readlinkat(from_dirfd, from, target, sizeof(target) - 1);
+	if (length == -1)
+	{
+		return false;
+	}
+	target[length] = '\0';
+
+	if (unlinkat(to_dirfd, to, 0) == -1 && errno != ENOENT)
+	{
+		return false;
+	}
+	if (symlinkat(target, to_dirfd, to) == -1)
+	{
+		return false;
+	}
+	struct timespec times[2] = {buf->st_atim, buf->st_mtim};
+	utimensat(to_dirfd, to, times, AT_SYMLINK_NOFOLLOW);
+	return true;
+}
+
+
+bool copy_file(int from_dirfd, const char *from, int to_dirfd, const char *to)
+{
+	struct stat buf;
+	if (fstatat(from_dirfd, from, &buf, AT_SYMLINK_NOFOLLOW) == -1)
+	{
+		return false;
+	}
+	// The destination is truncated or unlinked first: copying a file onto
+	// itself, or onto the file its link points to, would destroy it
+	struct stat target, linked;
+	if (fstatat(to_dirfd, to, &target, AT_SYMLINK_NOFOLLOW) == 0
+		&& (same_file(&buf, &target)
+			|| (S_ISLNK(buf.st_mode) && fstatat(from_dirfd, from, &linked, 0) == 0 && same_file(&linked, &target))
+			|| (S_ISREG(buf.st_mode) && fstatat(to_dirfd, to, &linked, 0) == 0 && same_file(&buf, &linked))))
+	{
+		errno = EINVAL;
+		return false;
+	}
+	if (S_ISLNK(buf.st_mode))
+	{
+		return copy_link(from_dirfd, from, to_dirfd, to, &buf);
+	}
+	if (S_ISFIFO(buf.st_mode))
+	{
+		if (unlinkat(to_dirfd, to, 0) == -1 && errno != ENOENT)
+		{
+			return false;
+		}
+		if (mkfifoat(to_dirfd, to, buf.st_mode & 07777) == -1)
+		{
+			return false;
+		}
+		struct timespec times[2] = {buf.st_atim, buf.st_mtim};
+		utimensat(to_dirfd, to, times, AT_SYMLINK_NOFOLLOW);
+		return true;
+	}
+	if (!S_ISREG(buf.st_mode))
+	{
+		errno = ENOTSUP;
+		return false;
+	}
+
+	int in = openat(from_dirfd, from, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+	if (in == -1)
+	{
+		return false;
+	}
+	// The permissions are only given once the data is written
+	int out = openat(to_dirfd, to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (out == -1)
+	{
+		int error = errno;
+		close(in);
+		errno = error;
+		return false;
+	}
+
+	// Sharing the blocks is instant, copying them is the fallback
+	bool copied = ioctl(out, FICLONE, in) == 0 || copy_data(in, out, buf.st_size);
+	if (copied)
+	{
+		struct timespec times[2] = {buf.st_atim, buf.st_mtim};
+		fchmod(out, buf.st_mode & 07777);
+		futimens(out, times);
+	}
+
+	int error = errno;
+	close(in);
+	if (close(out) == -1 && copied)
+	{
+		return false;
+	}
+	errno = error;
+	return copied;
+}
+
+
+// Create the copy of a directory inside the copy of its parent
+static bool copy_enter(Walker *walker, Walk_dir *dir)
+{
+	Copy *copy = walker->context;
+	int parent = dir->parent ? (int) (intptr_t) dir->parent->data : copy->to_dirfd;
+	const char *name = dir->parent ? dir->name : copy->to;
+
+	// Only the owner can write in it until its content is copied
+	if (mkdirat(parent, name, S_IRWXU) == -1 && errno != EEXIST)
+	{
+		walk_error(walker, dir, NULL);
+		return false;
+	}
+	int fd = openat(parent, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOFOLLOW);
+	if (fd == -1)
+	{
+		walk_error(walker, dir, NULL);
+		return false;
+	}
+	dir->data = (void *) (intptr_t) fd;
+	return true;
+}
+
+
+static bool copy_visit(Walker *walker, Walk_dir *dir, const char *name, unsigned char type)
+{
+	Copy *copy = walker->context;
+	if (type == DT_DIR)
+	{
+		return true;
+	}
+
+	if (copy->bounded)
+	{
+		while (sem_wait(&copy->slots) == -1)
+		{
+			continue;
+		}
+	}
+	if (!copy_file(dir->fd, name, (int) (intptr_t) dir->data, name))
+	{
+		walk_error(walker, dir, name);
+	}
+	if (copy->bounded)
+	{
+		sem_post(&copy->slots);
+	}
+	return false;
+}
+
+
+// Give the copy of a directory its attributes, once its content is copied
+static void copy_leave(Walker *walker, Walk_dir *dir)
+{
+	(void) walker;
+
+	int fd = (int) (intptr_t) dir->data;
+	struct stat buf;
+	if (fstat(dir->fd, &buf) == 0)
+	{
+		struct timespec times[2] = {buf.st_atim, buf.st_mtim};
+		fchmod(fd, buf.st_mode & 07777);
+		futimens(fd, times);
+	}
+	close(fd);
+}
+
+
+/**
+ * Check whether the copy of a directory would land in the directory
+ * itself or below it, going up from the destination, or its parent when
+ * it does not exist yet, to the root.
+*/
+static bool inside(const struct stat *dir, int to_dirfd, const char *to)
+{
+	int fd = openat(to_dirfd, to, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		char parent[PATH_MAX];
+		size_t end = strnlen(to, sizeof(parent) - 1);
+		while (end > 1 && to[end - 1] == '/')
+		{
+			end--;
+		}
+		while (end > 0 && to[end - 1] != '/')
+		{
+			end--;
+		}
+		if (end == 0)
+		{
+			strcpy(parent, ".");
+		}
+		else
+		{
+			memcpy(parent, to, end);
+			parent[end] = '\0';
+		}
+		fd = openat(to_dirfd, parent, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd == -1)
+		{
+			// The copy fails on its own
+			return false;
+		}
+	}
+
+	struct stat buf;
+	while (fstat(fd, &buf) == 0)
+	{
+		if (same_file(dir, &buf))
+		{
+			close(fd);
+			return true;
+		}
+		int parent = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		struct stat up;
+		if (parent == -1 || fstat(parent, &up) == -1 || same_file(&buf, &up))
+		{
+			// The root is its own parent
+			if (parent != -1)
+			{
+				close(parent);
+			}
+			break;
+		}
+		close(fd);
+		fd = parent;
+	}
+	close(fd);
+	return false;
+}
+
+
+bool copy_tree(int from_dirfd, const char *from, int to_dirfd, const char *to, int threads, int depth)
+{
+	struct stat buf;
+	if (fstatat(from_dirfd, from, &buf, AT_SYMLINK_NOFOLLOW) == -1)
+	{
+		fprintf(stderr, "Error: '%s': %m\n", from);
+		return false;
+	}
+	if (!S_ISDIR(buf.st_mode))
+	{
+		if (!copy_file(from_dirfd, from, to_dirfd, to))
+		{
+			fprintf(stderr, "Error: Failed to copy '%s': %m\n", from);
+			return false;
+		}
+		return true;
+	}
+
+	if (inside(&buf, to_dirfd, to))
+	{
+		fprintf(stderr, "Error: Cannot copy '%s' into itself, '%s'\n", from, to);
+		return false;
+	}
+
+	Copy copy = {.to_dirfd = to_dirfd, .to = to, .bounded = depth > 0 && depth < threads};
+	if (copy.bounded)
+	{
+		sem_init(&copy.slots, 0, depth);
+	}
+	Walker walker = {
+		.threads = threads,
+		.enter = copy_enter,
+		.visit = copy_visit,
+		.leave = copy_leave,
+		.context = &copy,
+	};
+	bool copied = walk(&walker, from_dirfd, from);
+	if (copy.bounded)
+	{
+		sem_destroy(&copy.slots);
+	}
+	return copied;
+}
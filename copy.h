@@ -0,0 +1,72 @@
+/**
+ * File copy declarations
+ * Files are copied by the kernel, sharing their blocks when the file
+ * system allows it, and directory trees are copied by several threads.
+*/
+#ifndef COPY_H
+#define COPY_H
+
+#include <stdbool.h>
+
+// Size of the buffer used when the kernel cannot copy the data itself
+#define SIZE_COPY (128 * 1024)
+
+
+/**
+ * bool copy_file(int from_dirfd, const char *from, int to_dirfd, const char *to)
+ * @brief Copy a single file.
+ * 
+ * @param[in] from_dirfd	Directory @p from is relative to.
+ * @param[in] from			Path of the file to copy.
+ * @param[in] to_dirfd		Directory @p to is relative to.
+ * @param[in] to			Path of the copy, replaced if it exists.
+ * @return					A boolean stating the outcome of the function.
+ * @retval					true on success.
+ * 							false on failure, 'errno' being set, to
+ * 							EINVAL when @p to is @p from itself.
+ * 
+ * The function copy_file() copies a regular file, a symbolic link or
+ * a named pipe, along with its permissions and modification time.
+ * The owner and the group are not kept: the copy belongs to the user
+ * running the shell, as with cp(1) without -p.
+ * The data of a regular file is first shared with a reflink
+ * (FICLONE), which is instant on file systems such as Btrfs or XFS.
+ * Otherwise, only the parts holding data, found with SEEK_DATA and
+ * SEEK_HOLE, are copied with copy_file_range(), so that holes stay
+ * holes. A buffer is only used when the kernel cannot do the copy.
+*/
+bool copy_file(int from_dirfd, const char *from, int to_dirfd, const char *to);
+
+
+/**
+ * bool copy_tree(int from_dirfd, const char *from, int to_dirfd, const char *to, int threads, int depth)
+ * @brief Copy a file or a directory and all of its content.
+ * 
+ * @param[in] from_dirfd	Directory @p from is relative to.
+ * @param[in] from			Path of the file or directory to copy.
+ * @param[in] to_dirfd		Directory @p to is relative to.
+ * @param[in] to			Path of the copy.
+ * @param[in] threads		Number of threads copying the content.
+ * @param[in] depth			Maximum number of files copied at once, 0
+ * 							for one per thread.
+ * @return					A boolean stating the outcome of the function.
+ * @retval					true on success.
+ * 							false if anything could not be copied.
+ * 
+ * The function copy_tree() copies @p from to @p to . A directory is
+ * not copied into itself or below it, which would never end. It is
+ * copied with a parallel walk: each directory is created relative to
+ * its copied parent and its files are copied with copy_file() by the
+ * thread that read it, so that independent subtrees are copied at
+ * the same time. The permissions and the modification time of each
+ * directory are set once its content is copied, its owner and group
+ * being those of the user running the shell. Errors are displayed
+ * on stderr and the rest of the tree is still copied. A @p depth
+ * lower than @p threads bounds the data transfers in flight, for
+ * devices slowed down by many concurrent streams, while directories
+ * are still read and created by all the threads.
+*/
+bool copy_tree(int from_dirfd, const char *from, int to_dirfd, const char *to, int threads, int depth);
+
+
+#endif // COPY_H
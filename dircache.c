@@ -0,0 +1,322 @@
+// Directory listing cache definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "dircache.h"
+
+// Changes of a directory that make its listing out of date
+#define WATCH_NAMES (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF)
+// Changes of an entry that only matter to the fields of the files
+#define WATCH_FIELDS (IN_ATTRIB | IN_MODIFY)
+
+
+Dir_cache dir_cache = {.lock = PTHREAD_MUTEX_INITIALIZER, .inotify = -1};
+
+
+// Size of a record, rounded up as the sorter does
+static size_t record_size(size_t length)
+{
+	return (sizeof(Record) + length + 1 + 7) & ~(size_t) 7;
+}
+
+
+static void unlink_dir(Cached_dir *dir)
+{
+	if (dir->prev != NULL)
+	{
+		dir->prev->next = dir->next;
+	}
+	else
+	{
+		dir_cache.head = dir->next;
+	}
+	if (dir->next != NULL)
+	{
+		dir->next->prev = dir->prev;
+	}
+	else
+	{
+		dir_cache.tail = dir->prev;
+	}
+	dir->prev = dir->next = NULL;
+}
+
+
+static void push_dir(Cached_dir *dir)
+{
+	dir->prev = NULL;
+	dir->next = dir_cache.head;
+	if (dir_cache.head != NULL)
+	{
+		dir_cache.head->prev = dir;
+	}
+	else
+	{
+		dir_cache.tail = dir;
+	}
+	dir_cache.head = dir;
+}
+
+
+/**
+ * Remove a listing from the cache and free it. The watch is only
+ * removed when no other listing shares it, the same directory being
+ * possibly read by another thread.
+*/
+static void drop_dir(Cached_dir *dir)
+{
+	unlink_dir(dir);
+	dir_cache.count--;
+	if (!dir->filling)
+	{
+		dir_cache.bytes -= dir->size;
+	}
+	bool shared = false;
+	for (Cached_dir *other = dir_cache.head; other != NULL && !shared; other = other->next)
+	{
+		shared = other->watch == dir->watch;
+	}
+	if (!shared)
+	{
+		inotify_rm_watch(dir_cache.inotify, dir->watch);
+	}
+	free(dir->data);
+	free(dir);
+}
+
+
+// Drop the least recently used listing, those being filled excepted
+static bool evict_oldest(void)
+{
+	Cached_dir *oldest = dir_cache.tail;
+	while (oldest != NULL && oldest->filling)
+	{
+		oldest = oldest->prev;
+	}
+	if (oldest == NULL)
+	{
+		return false;
+	}
+	drop_dir(oldest);
+	return true;
+}
+
+
+// Read the events reported so far, the lock being held
+static void read_events(void)
+{
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t bytes;
+	while ((bytes = read(dir_cache.inotify, events, sizeof(events))) > 0)
+	{
+		for (char *next = events; next < events + bytes; )
+		{
+			struct inotify_event *event = (struct inotify_event *) next;
+			next += sizeof(struct inotify_event) + event->len;
+
+			// Events were lost: nothing can be trusted anymore
+			bool all = event->mask & IN_Q_OVERFLOW;
+			Cached_dir *dir = dir_cache.head;
+			while (dir != NULL)
+			{
+				Cached_dir *following = dir->next;
+				bool changed = all || dir->watch == event->wd;
+				// Listings of names only are not concerned by the writes to the files
+				if (changed && !all && !(event->mask & ~WATCH_FIELDS) && dir->mask == 0)
+				{
+					changed = false;
+				}
+				if (changed && dir->filling)
+				{
+					dir->stale = true;
+				}
+				else if (changed)
+				{
+					drop_dir(dir);
+				}
+				dir = following;
+			}
+		}
+	}
+}
+
+
+bool dir_cache_list(int fd, unsigned int mask, bool hidden, Emit emit, void *context)
+{
+	struct stat buf;
+	if (fstat(fd, &buf) == -1)
+	{
+		return false;
+	}
+	pthread_mutex_lock(&dir_cache.lock);
+	if (dir_cache.inotify != -1)
+	{
+		read_events();
+	}
+
+	// The listing must hold at least the fields and the entries asked for
+	Cached_dir *dir = dir_cache.head;
+	while (dir != NULL && (dir->filling || dir->device != buf.st_dev || dir->inode != buf.st_ino
+		|| (dir->mask & mask) != mask || (hidden && !dir->hidden)))
+	{
+		dir = dir->next;
+	}
+	if (dir == NULL)
+	{
+		dir_cache.misses++;
+		pthread_mutex_unlock(&dir_cache.lock);
+		return false;
+	}
+	dir_cache.hits++;
+	unlink_dir(dir);
+	push_dir(dir);
+	for (size_t offset = 0; offset < dir->used; )
+	{
+		const Record *record = (const Record *) (dir->data + offset);
+		emit(record, context);
+		offset += record_size(record->length);
+	}
+	pthread_mutex_unlock(&dir_cache.lock);
+	return true;
+}
+
+
+Cached_dir *dir_cache_begin(int fd, unsigned int mask, bool hidden)
+{
+	struct stat buf;
+	if (fstat(fd, &buf) == -1)
+	{
+		return NULL;
+	}
+	Cached_dir *dir = calloc(1, sizeof(Cached_dir));
+	if (dir == NULL)
+	{
+		return NULL;
+	}
+	dir->device = buf.st_dev;
+	dir->inode = buf.st_ino;
+	dir->mask = mask;
+	dir->hidden = hidden;
+	dir->filling = true;
+
+	pthread_mutex_lock(&dir_cache.lock);
+	if (dir_cache.inotify == -1)
+	{
+		dir_cache.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	}
+	// Watches are limited for the whole user: the cache only takes some
+	if (dir_cache.count >= DIR_CACHE_LISTINGS && !evict_oldest())
+	{
+		pthread_mutex_unlock(&dir_cache.lock);
+		free(dir);
+		return NULL;
+	}
+	// The directory open is watched through its link in /proc, whatever its path
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	dir->watch = dir_cache.inotify == -1 ? -1
+		: inotify_add_watch(dir_cache.inotify, path, WATCH_NAMES | WATCH_FIELDS | IN_ONLYDIR);
+	if (dir->watch == -1)
+	{
+		pthread_mutex_unlock(&dir_cache.lock);
+		free(dir);
+		return NULL;
+	}
+	push_dir(dir);
+	dir_cache.count++;
+	pthread_mutex_unlock(&dir_cache.lock);
+	return dir;
+}
+
+
+bool dir_cache_add(Cached_dir *dir, const Record *fields, const char *name)
+{
+	// The listing is only used by the thread filling it, no lock is needed
+	size_t length = strlen(name);
+	size_t size = record_size(length);
+	if (dir->used + size > dir->size)
+	{
+		size_t capacity = dir->size ? dir->size * 2 : 4096;
+		while (capacity < dir->used + size)
+		{
+			capacity *= 2;
+		}
+		if (capacity > DIR_CACHE_BUDGET)
+		{
+			return false;
+		}
+		char *data = realloc(dir->data, capacity);
+		if (data == NULL)
+		{
+			return false;
+		}
+		dir->data = data;
+		dir->size = capacity;
+	}
+	Record *record = (Record *) (dir->data + dir->used);
+	*record = *fields;
+	record->length = length;
+	memcpy(record->name, name, length + 1);
+	dir->used += size;
+	dir->count++;
+	return true;
+}
+
+
+void dir_cache_end(Cached_dir *dir, bool complete)
+{
+	if (dir == NULL)
+	{
+		return;
+	}
+	pthread_mutex_lock(&dir_cache.lock);
+	read_events();
+	if (!complete || dir->stale)
+	{
+		drop_dir(dir);
+		pthread_mutex_unlock(&dir_cache.lock);
+		return;
+	}
+
+	// An older listing of the same directory is replaced
+	for (Cached_dir *other = dir_cache.head; other != NULL; other = other->next)
+	{
+		if (other != dir && !other->filling && other->device == dir->device && other->inode == dir->inode)
+		{
+			drop_dir(other);
+			break;
+		}
+	}
+	dir->filling = false;
+	dir_cache.bytes += dir->size;
+	// Listings being filled are not counted yet, the least recently used is
+	while (dir_cache.bytes > DIR_CACHE_BUDGET && evict_oldest())
+	{
+		continue;
+	}
+	pthread_mutex_unlock(&dir_cache.lock);
+}
+
+
+void dir_cache_free(void)
+{
+	pthread_mutex_lock(&dir_cache.lock);
+	while (dir_cache.head != NULL)
+	{
+		drop_dir(dir_cache.head);
+	}
+	if (dir_cache.inotify != -1)
+	{
+		close(dir_cache.inotify);
+		dir_cache.inotify = -1;
+	}
+	pthread_mutex_unlock(&dir_cache.lock);
+}
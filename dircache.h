@@ -0,0 +1,150 @@
+/**
+ * Directory listing cache declarations
+ * The entries of the directories listed by ls are kept in memory,
+ * along with the fields of the files that were examined, until
+ * inotify reports a change of the directory.
+*/
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "sort.h"
+
+// Memory used by the cached listings at most
+#define DIR_CACHE_BUDGET (32 * 1024 * 1024)
+// Listings kept at most, each holding an inotify watch of the user's limited number
+#define DIR_CACHE_LISTINGS 512
+
+/**
+ * @brief @struct type for the listing of a directory.
+ *
+ * The directory is identified by its device and inode numbers. Its
+ * entries are packed one after another in @p data , as the records
+ * of a sorter. @p mask holds the statx() fields the records were
+ * given, and @p hidden whether the hidden entries are part of them.
+ * A listing is @p filling while ls reads the directory, and @p stale
+ * once a change was reported meanwhile.
+*/
+typedef struct cached_dir
+{
+	dev_t device;
+	ino_t inode;
+	int watch;
+	unsigned int mask;
+	bool hidden;
+	bool filling;
+	bool stale;
+	char *data;
+	size_t used;
+	size_t size;
+	size_t count;
+	// Neighbours in the order of use, most recent first
+	struct cached_dir *prev;
+	struct cached_dir *next;
+} Cached_dir;
+
+/**
+ * @brief @struct type for the cache of the directory listings.
+ *
+ * The listings are chained from the most recently used one to the
+ * least recently used one, which is evicted first once @p bytes
+ * goes over DIR_CACHE_BUDGET, or before a new listing would take
+ * @p count over DIR_CACHE_LISTINGS.
+*/
+typedef struct dir_cache
+{
+	pthread_mutex_t lock;
+	int inotify;
+	Cached_dir *head;
+	Cached_dir *tail;
+	size_t bytes;
+	size_t count;
+	unsigned long hits;
+	unsigned long misses;
+} Dir_cache;
+
+// Cache of the listings, shared by the threads running ls
+extern Dir_cache dir_cache;
+
+
+/**
+ * bool dir_cache_list(int fd, unsigned int mask, bool hidden, Emit emit, void *context)
+ * @brief Give the cached entries of a directory.
+ *
+ * @param[in] fd		Directory to list.
+ * @param[in] mask		statx() fields the records need.
+ * @param[in] hidden	Whether the hidden entries are needed.
+ * @param[in] emit		Function called with each record.
+ * @param[in] context	Pointer given to @p emit .
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true if the directory was found in the cache.
+ * 						false if it has to be read.
+ *
+ * The function dir_cache_list() first reads the events reported by
+ * inotify, dropping the listings of the directories changed. A hit
+ * or a miss is counted.
+*/
+bool dir_cache_list(int fd, unsigned int mask, bool hidden, Emit emit, void *context);
+
+
+/**
+ * Cached_dir *dir_cache_begin(int fd, unsigned int mask, bool hidden)
+ * @brief Start the listing of a directory about to be read.
+ *
+ * @param[in] fd		Directory to be read.
+ * @param[in] mask		statx() fields the records are given.
+ * @param[in] hidden	Whether the hidden entries are added.
+ * @return				Listing to fill with dir_cache_add().
+ * @retval				'Cached_dir' pointer on success.
+ * 						NULL pointer if the directory cannot be watched.
+ *
+ * The directory is watched before it is read, so that a change
+ * made while it is read is not missed. The least recently used
+ * listing is evicted first if DIR_CACHE_LISTINGS are kept.
+*/
+Cached_dir *dir_cache_begin(int fd, unsigned int mask, bool hidden);
+
+
+/**
+ * bool dir_cache_add(Cached_dir *dir, const Record *fields, const char *name)
+ * @brief Add an entry to a listing being filled.
+ *
+ * @param[in] dir		Listing being filled.
+ * @param[in] fields	Fields of the entry.
+ * @param[in] name		Name of the entry.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if memory is lacking.
+*/
+bool dir_cache_add(Cached_dir *dir, const Record *fields, const char *name);
+
+
+/**
+ * void dir_cache_end(Cached_dir *dir, bool complete)
+ * @brief Add a filled listing to the cache.
+ *
+ * @param[in] dir		Listing filled, or NULL.
+ * @param[in] complete	Whether every entry of the directory was added.
+ * @return				Nothing.
+ *
+ * The listing is dropped if it is not complete, or if the directory
+ * changed while it was read. The least recently used listings are
+ * evicted to make room for it.
+*/
+void dir_cache_end(Cached_dir *dir, bool complete);
+
+
+/**
+ * void dir_cache_free(void)
+ * @brief Drop every listing and close the inotify instance.
+ *
+ * @return			Nothing.
+*/
+void dir_cache_free(void);
+
+
+#endif // DIRCACHE_H
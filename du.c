@@ -0,0 +1,500 @@
+// Disk usage definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "du.h"
+#include "cache.h"
+#include "walker.h"
+
+
+/**
+ * @brief @struct type for the total of a directory to display.
+*/
+typedef struct du_line
+{
+	char *path;
+	long long blocks;
+} Du_line;
+
+/**
+ * @brief @struct type for the state of a walk summing the blocks.
+*/
+typedef struct du_walk
+{
+	Du_cache *cache;
+	bool cached;
+	// Files with several links already counted
+	Du_cache links;
+	int depth;
+	pthread_mutex_t lock;
+	Du_line *lines;
+	size_t count;
+	size_t capacity;
+} Du_walk;
+
+/**
+ * @brief @struct type for a directory being walked.
+ *
+ * The subdirectories add their totals to @p total when they are left,
+ * possibly from other threads.
+*/
+typedef struct du_dir
+{
+	atomic_llong total;
+	Du_record record;
+	bool cached;
+	bool failed;
+	// Holds files with several links: its total depends on the walk
+	bool linked;
+} Du_dir;
+
+
+atomic_ulong du_reused;
+atomic_ulong du_scanned;
+
+// Runs in different threads of a pipeline would share the temporary file
+static pthread_mutex_t save_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static size_t record_slot(const Du_cache *cache, dev_t device, ino_t inode)
+{
+	unsigned long long key[2] = {device, inode};
+	size_t slot = hash_bytes(key, sizeof(key), CACHE_SEED) & (cache->capacity - 1);
+	while (cache->records[slot].inode != 0
+		&& (cache->records[slot].device != device || cache->records[slot].inode != inode))
+	{
+		slot = (slot + 1) & (cache->capacity - 1);
+	}
+	return slot;
+}
+
+
+static const Du_record *find_record(const Du_cache *cache, dev_t device, ino_t inode)
+{
+	if (cache->capacity == 0)
+	{
+		return NULL;
+	}
+	const Du_record *record = &cache->records[record_slot(cache, device, inode)];
+	return record->inode != 0 ? record : NULL;
+}
+
+
+// Add or replace a record, doubling the index when it gets half full
+static bool put_record(Du_cache *cache, const Du_record *record)
+{
+	if ((cache->count + 1) * 2 > cache->capacity)
+	{
+		size_t capacity = cache->capacity ? cache->capacity * 2 : 1024;
+		Du_record *records = calloc(capacity, sizeof(Du_record));
+		if (records == NULL)
+		{
+			return false;
+		}
+		Du_cache grown = {.records = records, .capacity = capacity};
+		for (size_t i = 0; i < cache->capacity; i++)
+		{
+			if (cache->records[i].inode != 0)
+			{
+				records[record_slot(&grown, cache->records[i].device, cache->records[i].inode)] = cache->records[i];
+			}
+		}
+		free(cache->records);
+		cache->records = records;
+		cache->capacity = capacity;
+	}
+	Du_record *slot = &cache->records[record_slot(cache, record->device, record->inode)];
+	cache->count += slot->inode == 0;
+	*slot = *record;
+	return true;
+}
+
+
+// Path of the cache file, false if there is no home directory
+static bool cache_path(char path[PATH_MAX], const char *suffix)
+{
+	const char *home = getenv("HOME");
+	return home != NULL && home[0] != '\0'
+		&& snprintf(path, PATH_MAX, "%s/%s%s", home, DU_CACHE, suffix) < PATH_MAX;
+}
+
+
+// Load the records of the previous runs, a missing or damaged file being an empty one
+static void load_cache(Du_cache *cache)
+{
+	char path[PATH_MAX];
+	FILE *file = cache_path(path, "") ? fopen(path, "re") : NULL;
+	if (file == NULL)
+	{
+		return;
+	}
+	/**
+	 * Each line holds: device, inode, modification time and blocks of a
+	 * directory, then device and inode of its parent. Lines of another
+	 * format are skipped.
+	*/
+	char line[128];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		unsigned long long device, inode, parent_device, parent_inode;
+		long long mtime, blocks;
+		if (sscanf(line, "%llu %llu %lld %lld %llu %llu", &device, &inode, &mtime, &blocks,
+			&parent_device, &parent_inode) != 6 || inode == 0)
+		{
+			continue;
+		}
+		Du_record record = {
+			.device = device,
+			.inode = inode,
+			.parent_device = parent_device,
+			.parent_inode = parent_inode,
+			.mtime = mtime,
+			.blocks = blocks,
+		};
+		if (!put_record(cache, &record))
+		{
+			break;
+		}
+	}
+	fclose(file);
+}
+
+
+/**
+ * Tell whether a record is out of date after a walk: its directory was
+ * examined and not found reusable, or it was not met although its parent
+ * was, or its parent is itself out of date. @p dropped gathers the
+ * records found out of date so far.
+*/
+static bool out_of_date(const Du_record *record, const Du_cache *met, const Du_cache *dropped)
+{
+	const Du_record *self = find_record(met, record->device, record->inode);
+	if (self != NULL)
+	{
+		return self->blocks < 0;
+	}
+	return find_record(met, record->parent_device, record->parent_inode) != NULL
+		|| find_record(dropped, record->parent_device, record->parent_inode) != NULL;
+}
+
+
+// Write the records to a temporary file, renamed over the previous one
+static void save_cache(Du_cache *cache, const Du_cache *dropped)
+{
+	char path[PATH_MAX], temporary[PATH_MAX];
+	if (!cache_path(path, "") || !cache_path(temporary, ".tmp"))
+	{
+		return;
+	}
+	int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	FILE *file = fd == -1 ? NULL : fdopen(fd, "w");
+	if (file == NULL)
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		fprintf(stderr, "Error: Cannot save the disk usage cache: %m\n");
+		return;
+	}
+	for (size_t i = 0; i < cache->capacity; i++)
+	{
+		Du_record *record = &cache->records[i];
+		if (record->inode != 0 && find_record(dropped, record->device, record->inode) == NULL)
+		{
+			fprintf(file, "%llu %llu %lld %lld %llu %llu\n", (unsigned long long) record->device,
+				(unsigned long long) record->inode, record->mtime, record->blocks,
+				(unsigned long long) record->parent_device, (unsigned long long) record->parent_inode);
+		}
+	}
+	if (fclose(file) == 0)
+	{
+		rename(temporary, path);
+	}
+}
+
+
+static bool usage_enter(Walker *walker, Walk_dir *dir)
+{
+	Du_walk *usage = walker->context;
+	struct stat buf;
+	Du_dir *data = calloc(1, sizeof(Du_dir));
+	if (data == NULL || fstat(dir->fd, &buf) == -1)
+	{
+		free(data);
+		walk_error(walker, dir, NULL);
+		return false;
+	}
+	data->record = (Du_record) {
+		.device = buf.st_dev,
+		.inode = buf.st_ino,
+		.mtime = buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec,
+		.blocks = buf.st_blocks,
+	};
+	struct stat up;
+	if (dir->parent != NULL)
+	{
+		Du_dir *parent = dir->parent->data;
+		data->record.parent_device = parent->record.device;
+		data->record.parent_inode = parent->record.inode;
+	}
+	else if (usage->cached && fstatat(dir->fd, "..", &up, 0) == 0)
+	{
+		data->record.parent_device = up.st_dev;
+		data->record.parent_inode = up.st_ino;
+	}
+
+	// Unchanged since the last run: the files need not be examined
+	const Du_record *record = usage->cached ? find_record(usage->cache, buf.st_dev, buf.st_ino) : NULL;
+	if (record != NULL && record->mtime == data->record.mtime)
+	{
+		data->record.blocks = record->blocks;
+		data->cached = true;
+	}
+	dir->data = data;
+	return true;
+}
+
+
+static bool usage_visit(Walker *walker, Walk_dir *dir, const char *name, unsigned char type)
+{
+	Du_walk *usage = walker->context;
+	Du_dir *data = dir->data;
+	if (type == DT_DIR)
+	{
+		return true;
+	}
+	if (data->cached)
+	{
+		return false;
+	}
+	// The entries of a directory are all read by the same thread
+	struct stat buf;
+	if (fstatat(dir->fd, name, &buf, AT_SYMLINK_NOFOLLOW) == -1)
+	{
+		walk_error(walker, dir, name);
+		data->failed = true;
+		return false;
+	}
+
+	// A file with several links is counted under the first name met
+	if (buf.st_nlink > 1)
+	{
+		data->linked = true;
+		Du_record link = {.device = buf.st_dev, .inode = buf.st_ino};
+		pthread_mutex_lock(&usage->links.lock);
+		bool counted = find_record(&usage->links, buf.st_dev, buf.st_ino) != NULL;
+		if (!counted)
+		{
+			put_record(&usage->links, &link);
+		}
+		pthread_mutex_unlock(&usage->links.lock);
+		if (counted)
+		{
+			return false;
+		}
+	}
+	data->record.blocks += buf.st_blocks;
+	return false;
+}
+
+
+static void usage_scanned(Walker *walker, Walk_dir *dir)
+{
+	Du_walk *usage = walker->context;
+	Du_dir *data = dir->data;
+	atomic_fetch_add(&data->total, data->record.blocks);
+
+	if (!usage->cached)
+	{
+		return;
+	}
+	Du_cache *cache = usage->cache;
+	pthread_mutex_lock(&cache->lock);
+	if (data->cached)
+	{
+		cache->reused++;
+	}
+	else
+	{
+		cache->scanned++;
+	}
+	if (cache->fresh_count == cache->fresh_capacity)
+	{
+		size_t capacity = cache->fresh_capacity ? cache->fresh_capacity * 2 : 256;
+		Du_record *fresh = realloc(cache->fresh, capacity * sizeof(Du_record));
+		if (fresh != NULL)
+		{
+			cache->fresh = fresh;
+			cache->fresh_capacity = capacity;
+		}
+	}
+	/**
+	 * Every directory met is recorded, to find those that were removed.
+	 * A total missing some files, or depending on where the links were
+	 * met first, must not be reused: its blocks are left negative.
+	*/
+	if (cache->fresh_count < cache->fresh_capacity)
+	{
+		Du_record record = data->record;
+		if (data->failed || data->linked)
+		{
+			record.blocks = -1;
+		}
+		cache->fresh[cache->fresh_count++] = record;
+	}
+	pthread_mutex_unlock(&cache->lock);
+}
+
+
+// The subdirectories are all left: the total of the directory is known
+static void usage_leave(Walker *walker, Walk_dir *dir)
+{
+	Du_walk *usage = walker->context;
+	Du_dir *data = dir->data;
+	long long total = atomic_load(&data->total);
+	if (dir->parent != NULL)
+	{
+		atomic_fetch_add(&((Du_dir *) dir->parent->data)->total, total);
+	}
+
+	if (usage->depth < 0 || dir->depth <= usage->depth)
+	{
+		char *path = strdup(dir->path);
+		pthread_mutex_lock(&usage->lock);
+		if (usage->count == usage->capacity)
+		{
+			size_t capacity = usage->capacity ? usage->capacity * 2 : 256;
+			Du_line *lines = realloc(usage->lines, capacity * sizeof(Du_line));
+			if (lines != NULL)
+			{
+				usage->lines = lines;
+				usage->capacity = capacity;
+			}
+		}
+		if (path != NULL && usage->count < usage->capacity)
+		{
+			usage->lines[usage->count++] = (Du_line) {.path = path, .blocks = total};
+			path = NULL;
+		}
+		pthread_mutex_unlock(&usage->lock);
+		free(path);
+	}
+	free(data);
+	dir->data = NULL;
+}
+
+
+/**
+ * Compare two paths component by component, so that a directory comes
+ * right after its content, as du displays it.
+*/
+static int compare_lines(const void *a, const void *b)
+{
+	const unsigned char *first = (const unsigned char *) ((const Du_line *) a)->path;
+	const unsigned char *second = (const unsigned char *) ((const Du_line *) b)->path;
+	while (*first != '\0' && *first == *second)
+	{
+		first++;
+		second++;
+	}
+	if (*first == '\0' && *second == '/')
+	{
+		return 1;
+	}
+	if (*first == '/' && *second == '\0')
+	{
+		return -1;
+	}
+	int key_first = *first == '/' ? 0 : *first ? *first + 1 : 0;
+	int key_second = *second == '/' ? 0 : *second ? *second + 1 : 0;
+	return key_first - key_second;
+}
+
+
+bool disk_usage(int dirfd, const char *path, int threads, int depth, bool cached, FILE *out)
+{
+	Du_cache cache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+	if (cached)
+	{
+		load_cache(&cache);
+	}
+
+	Du_walk usage = {
+		.cache = &cache,
+		.cached = cached,
+		.links = {.lock = PTHREAD_MUTEX_INITIALIZER},
+		.depth = depth,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	Walker walker = {
+		.threads = threads,
+		.enter = usage_enter,
+		.visit = usage_visit,
+		.scanned = usage_scanned,
+		.leave = usage_leave,
+		.context = &usage,
+	};
+	bool success = walk(&walker, dirfd, path);
+	free(usage.links.records);
+
+	// Sizes are displayed in kibibytes, as blocks are 512 bytes long
+	if (usage.count > 0)
+	{
+		qsort(usage.lines, usage.count, sizeof(Du_line), compare_lines);
+	}
+	for (size_t i = 0; i < usage.count; i++)
+	{
+		fprintf(out, "%lld\t%s\n", usage.lines[i].blocks / 2, usage.lines[i].path);
+		free(usage.lines[i].path);
+	}
+	free(usage.lines);
+
+	if (cache.fresh_count > 0)
+	{
+		// The records of the directories met replace those of the previous run
+		Du_cache met = {0}, dropped = {0};
+		for (size_t i = 0; i < cache.fresh_count; i++)
+		{
+			put_record(&met, &cache.fresh[i]);
+			if (cache.fresh[i].blocks >= 0)
+			{
+				put_record(&cache, &cache.fresh[i]);
+			}
+		}
+		// Those of the directories removed are dropped, down to their subtrees
+		for (bool changed = true; changed; )
+		{
+			changed = false;
+			for (size_t i = 0; i < cache.capacity; i++)
+			{
+				Du_record *record = &cache.records[i];
+				if (record->inode != 0 && find_record(&dropped, record->device, record->inode) == NULL
+					&& out_of_date(record, &met, &dropped))
+				{
+					changed |= put_record(&dropped, record);
+				}
+			}
+		}
+		pthread_mutex_lock(&save_lock);
+		save_cache(&cache, &dropped);
+		pthread_mutex_unlock(&save_lock);
+		free(met.records);
+		free(dropped.records);
+	}
+	atomic_fetch_add(&du_reused, cache.reused);
+	atomic_fetch_add(&du_scanned, cache.scanned);
+	free(cache.fresh);
+	free(cache.records);
+	return success;
+}
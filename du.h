@@ -0,0 +1,97 @@
+/**
+ * Disk usage declarations
+ * The blocks used by directory trees are summed by a pool of threads.
+ * On request, the blocks of the files of each directory are kept in a
+ * cache file, so that the directories left unchanged are not examined
+ * again.
+*/
+#ifndef DU_H
+#define DU_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Cache file, in the home directory of the user
+#define DU_CACHE ".cli_du_cache"
+
+/**
+ * @brief @struct type for the blocks used by a directory itself.
+ *
+ * @p blocks counts the 512-byte blocks of the directory and of the
+ * files it holds, its subdirectories apart. They stay valid as long
+ * as the modification time of the directory is @p mtime , which
+ * changes whenever an entry is added, removed or renamed. The parent
+ * directory is kept to notice the directories that were removed.
+*/
+typedef struct du_record
+{
+	dev_t device;
+	ino_t inode;
+	dev_t parent_device;
+	ino_t parent_inode;
+	long long mtime;
+	long long blocks;
+} Du_record;
+
+/**
+ * @brief @struct type for the cache of the directory blocks.
+ *
+ * The records are indexed by open addressing on their device and
+ * inode numbers, with a load factor of at most 1/2. The records of
+ * the directories met during a walk are gathered in @p fresh , and
+ * only added to the index once the walk is over.
+*/
+typedef struct du_cache
+{
+	Du_record *records;
+	size_t count;
+	size_t capacity;
+	pthread_mutex_t lock;
+	Du_record *fresh;
+	size_t fresh_count;
+	size_t fresh_capacity;
+	// Directories whose files were not examined
+	unsigned long reused;
+	unsigned long scanned;
+} Du_cache;
+
+// Directories counted from the cache and scanned, over all the runs
+extern atomic_ulong du_reused;
+extern atomic_ulong du_scanned;
+
+
+/**
+ * bool disk_usage(int dirfd, const char *path, int threads, int depth, bool cached, FILE *out)
+ * @brief Display the disk usage of a directory tree.
+ *
+ * @param[in] dirfd		Directory @p path is relative to.
+ * @param[in] path		Root of the tree.
+ * @param[in] threads	Number of threads of the walk.
+ * @param[in] depth		Depth of the directories displayed at most,
+ * 						-1 for all of them.
+ * @param[in] cached	Whether to use and update the cache file.
+ * @param[in] out		Stream to display the usage to.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if an error was met.
+ *
+ * The function disk_usage() sums the blocks allocated to the files of
+ * the tree, in kibibytes, and displays the total of each directory
+ * after those of its subdirectories. A file with several hard links
+ * is counted once. With @p cached , a directory whose modification
+ * time did not change since a previous run has its files counted
+ * from the cache, without examining them: its subdirectories are
+ * still walked. A file that grew or shrank in place does not change
+ * the modification time of its directory, and is not noticed. The
+ * directories holding files with several links are always examined,
+ * and the records of the directories removed from the tree are
+ * dropped from the file.
+*/
+bool disk_usage(int dirfd, const char *path, int threads, int depth, bool cached, FILE *out);
+
+
+#endif // DU_H
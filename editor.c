@@ -0,0 +1,569 @@
+// Line editor definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <sys/dir.h>
+
+#include "editor.h"
+#include "commands.h"
+#include "utils.h"
+
+// Kinds of the names of a trie, telling what follows a completed name
+#define TRIE_NAME 1
+#define TRIE_DIRECTORY 2
+
+// Changes of a directory that make its trie out of date
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+
+// Empty a trie, keeping its memory, the root being the only node left
+static bool trie_reset(Trie *trie)
+{
+	if (trie->nodes == NULL)
+	{
+		trie->capacity = 1024;
+		trie->nodes = malloc(trie->capacity * sizeof(Trie_node));
+		if (trie->nodes == NULL)
+		{
+			trie->capacity = 0;
+			return false;
+		}
+	}
+	trie->nodes[0] = (Trie_node) {0};
+	trie->count = 1;
+	return true;
+}
+
+
+static bool trie_add(Trie *trie, const char *name, unsigned char kind)
+{
+	// Room is made first, so that no node moves while the name is added
+	size_t length = strlen(name);
+	if (trie->count + length > trie->capacity)
+	{
+		unsigned int capacity = trie->capacity;
+		while (trie->count + length > capacity)
+		{
+			capacity *= 2;
+		}
+		Trie_node *nodes = realloc(trie->nodes, capacity * sizeof(Trie_node));
+		if (nodes == NULL)
+		{
+			return false;
+		}
+		trie->nodes = nodes;
+		trie->capacity = capacity;
+	}
+
+	unsigned int node = 0;
+	trie->nodes[0].words++;
+	for (size_t i = 0; i < length; i++)
+	{
+		// The children are kept in the order of their labels
+		unsigned char label = name[i];
+		unsigned int *link = &trie->nodes[node].child;
+		while (*link != 0 && (unsigned char) trie->nodes[*link].label < label)
+		{
+			link = &trie->nodes[*link].sibling;
+		}
+		if (*link == 0 || (unsigned char) trie->nodes[*link].label != label)
+		{
+			unsigned int added = trie->count++;
+			trie->nodes[added] = (Trie_node) {.sibling = *link, .label = name[i]};
+			*link = added;
+		}
+		node = *link;
+		trie->nodes[node].words++;
+	}
+	trie->nodes[node].kind = kind;
+	return true;
+}
+
+
+// Get the node a prefix leads to
+static bool trie_find(const Trie *trie, const char *prefix, size_t length, unsigned int *node)
+{
+	*node = 0;
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned int child = trie->nodes[*node].child;
+		while (child != 0 && trie->nodes[child].label != prefix[i])
+		{
+			child = trie->nodes[child].sibling;
+		}
+		if (child == 0)
+		{
+			return false;
+		}
+		*node = child;
+	}
+	return true;
+}
+
+
+// Display the names ending below a node, @p name holding the path to it
+static void trie_list(const Trie *trie, unsigned int node, char *name, size_t length, int *listed)
+{
+	if (trie->nodes[node].kind)
+	{
+		if (*listed < EDITOR_LIST_MAX)
+		{
+			printf("%.*s%s\n", (int) length, name, trie->nodes[node].kind == TRIE_DIRECTORY ? "/" : "");
+		}
+		(*listed)++;
+	}
+	for (unsigned int child = trie->nodes[node].child; child != 0 && length < NAME_MAX; child = trie->nodes[child].sibling)
+	{
+		name[length] = trie->nodes[child].label;
+		trie_list(trie, child, name, length + 1, listed);
+	}
+}
+
+
+bool editor_init(Editor *editor)
+{
+	memset(editor, 0, sizeof(*editor));
+	editor->watch = -1;
+	editor->inotify = -1;
+	if (tcgetattr(STDIN_FILENO, &editor->saved) == -1)
+	{
+		return false;
+	}
+
+	// The builtins never change, they are indexed once
+	if (!trie_reset(&editor->commands) || !trie_reset(&editor->files))
+	{
+		editor_free(editor);
+		return false;
+	}
+	for (int i = 0; i < command_count; i++)
+	{
+		if (commands[i].name != NULL)
+		{
+			trie_add(&editor->commands, commands[i].name, TRIE_NAME);
+		}
+	}
+
+	// Without inotify, the files are read again at each completion
+	editor->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	return true;
+}
+
+
+void editor_free(Editor *editor)
+{
+	free(editor->buffer);
+	free(editor->commands.nodes);
+	free(editor->files.nodes);
+	if (editor->inotify != -1)
+	{
+		close(editor->inotify);
+	}
+	memset(editor, 0, sizeof(*editor));
+	editor->watch = -1;
+	editor->inotify = -1;
+}
+
+
+// Read the events of the watch, any of them making the trie out of date
+static void read_events(Editor *editor)
+{
+	if (editor->inotify == -1)
+	{
+		return;
+	}
+	char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t bytes;
+	while ((bytes = read(editor->inotify, events, sizeof(events))) > 0)
+	{
+		for (char *next = events; next < events + bytes; )
+		{
+			struct inotify_event *event = (struct inotify_event *) next;
+			if (event->wd == editor->watch)
+			{
+				editor->files_valid = false;
+			}
+			next += sizeof(struct inotify_event) + event->len;
+		}
+	}
+}
+
+
+/**
+ * Make the trie of the files hold the names of a directory. It is
+ * only built again when another directory is completed, or when the
+ * watch reported a change.
+*/
+static bool index_files(Editor *editor, const char *directory)
+{
+	read_events(editor);
+	struct stat buf;
+	if (fstatat(cwd.fd, directory, &buf, 0) == -1 || !S_ISDIR(buf.st_mode))
+	{
+		return false;
+	}
+	if (editor->files_valid && buf.st_dev == editor->device && buf.st_ino == editor->inode)
+	{
+		return true;
+	}
+
+	// The watch is set first, so that no change made while reading is missed
+	editor->files_valid = false;
+	if (editor->watch != -1)
+	{
+		inotify_rm_watch(editor->inotify, editor->watch);
+		editor->watch = -1;
+	}
+	if (editor->inotify != -1)
+	{
+		// The process follows the working directory of the shell, relative paths work
+		editor->watch = inotify_add_watch(editor->inotify, directory, WATCH_EVENTS | IN_ONLYDIR);
+	}
+
+	int fd = openat(cwd.fd, directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+	if (dir == NULL)
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		return false;
+	}
+	trie_reset(&editor->files);
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		const char *name = entry->d_name;
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+		{
+			continue;
+		}
+		// Links are followed, a link to a directory being completed as one
+		bool directory_entry = entry->d_type == DT_DIR;
+		struct stat target;
+		if ((entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) && fstatat(fd, name, &target, 0) == 0)
+		{
+			directory_entry = S_ISDIR(target.st_mode);
+		}
+		if (!trie_add(&editor->files, name, directory_entry ? TRIE_DIRECTORY : TRIE_NAME))
+		{
+			break;
+		}
+	}
+	closedir(dir);
+	editor->device = buf.st_dev;
+	editor->inode = buf.st_ino;
+	editor->files_valid = editor->watch != -1;
+	return true;
+}
+
+
+// Make sure the line can hold @p extra more characters and its terminator
+static bool reserve_line(Editor *editor, size_t extra)
+{
+	if (editor->length + extra + 1 <= editor->size)
+	{
+		return true;
+	}
+	size_t size = editor->size ? editor->size : SIZE_INPUT;
+	while (editor->length + extra + 1 > size)
+	{
+		size *= 2;
+	}
+	char *buffer = realloc(editor->buffer, size);
+	if (buffer == NULL)
+	{
+		return false;
+	}
+	editor->buffer = buffer;
+	editor->size = size;
+	return true;
+}
+
+
+static void insert_text(Editor *editor, const char *text, size_t length)
+{
+	if (!reserve_line(editor, length))
+	{
+		return;
+	}
+	char *at = editor->buffer + editor->cursor;
+	memmove(at + length, at, editor->length - editor->cursor);
+	memcpy(at, text, length);
+	editor->length += length;
+	editor->cursor += length;
+}
+
+
+// Display the prompt and the line again, the cursor at its place
+static void refresh(Editor *editor, const char *prompt)
+{
+	char move[32];
+	int moved = 0;
+	if (editor->cursor < editor->length)
+	{
+		moved = snprintf(move, sizeof(move), "\x1b[%zuD", editor->length - editor->cursor);
+	}
+	dprintf(STDOUT_FILENO, "\r%s%.*s\x1b[K%.*s", prompt, (int) editor->length, editor->buffer, moved, move);
+}
+
+
+// Complete the word before the cursor, or list the candidates
+static void complete(Editor *editor, const char *prompt)
+{
+	size_t start = editor->cursor;
+	while (start > 0 && editor->buffer[start - 1] != ' ')
+	{
+		start--;
+	}
+
+	// The first word of a command names a builtin, a pipe starting a new command
+	size_t before = start;
+	while (before > 0 && editor->buffer[before - 1] == ' ')
+	{
+		before--;
+	}
+	bool command = before == 0 || editor->buffer[before - 1] == '|';
+
+	const char *word = editor->buffer + start;
+	size_t length = editor->cursor - start;
+	Trie *trie = &editor->commands;
+	if (!command || memchr(word, '/', length) != NULL)
+	{
+		// The names of the files are those of the directory the word is in
+		const char *slash = memrchr(word, '/', length);
+		char *directory = slash == NULL ? strdup(".")
+			: slash == word ? strdup("/") : strndup(word, slash - word);
+		bool indexed = directory != NULL && index_files(editor, directory);
+		free(directory);
+		if (!indexed)
+		{
+			dprintf(STDOUT_FILENO, "\a");
+			return;
+		}
+		trie = &editor->files;
+		if (slash != NULL)
+		{
+			length -= slash + 1 - word;
+			word = slash + 1;
+		}
+	}
+
+	unsigned int node;
+	if (!trie_find(trie, word, length, &node) || trie->nodes[node].words == 0)
+	{
+		dprintf(STDOUT_FILENO, "\a");
+		return;
+	}
+
+	// Follow the path shared by all the candidates
+	char extension[NAME_MAX + 1];
+	size_t extended = 0;
+	while (!trie->nodes[node].kind && extended < NAME_MAX)
+	{
+		unsigned int child = trie->nodes[node].child;
+		if (child == 0 || trie->nodes[child].sibling != 0)
+		{
+			break;
+		}
+		extension[extended++] = trie->nodes[child].label;
+		node = child;
+	}
+
+	// A single candidate is completed along with what follows it
+	if (trie->nodes[node].words == 1 && trie->nodes[node].kind)
+	{
+		extension[extended++] = trie->nodes[node].kind == TRIE_DIRECTORY ? '/' : ' ';
+	}
+	if (extended > 0)
+	{
+		insert_text(editor, extension, extended);
+		editor->tabbed = false;
+		refresh(editor, prompt);
+		return;
+	}
+
+	// The candidates are displayed when Tab is pressed twice
+	if (!editor->tabbed)
+	{
+		editor->tabbed = true;
+		dprintf(STDOUT_FILENO, "\a");
+		return;
+	}
+	char name[NAME_MAX + 1];
+	if (length > NAME_MAX)
+	{
+		return;
+	}
+	memcpy(name, word, length);
+	int listed = 0;
+	printf("\n");
+	trie_list(trie, node, name, length, &listed);
+	if (listed > EDITOR_LIST_MAX)
+	{
+		printf("... and %d more\n", listed - EDITOR_LIST_MAX);
+	}
+	fflush(stdout);
+	refresh(editor, prompt);
+}
+
+
+// Handle the escape sequence of a special key, the escape character read
+static void escape_key(Editor *editor)
+{
+	char sequence[3];
+	if (read(STDIN_FILENO, sequence, 1) != 1 || sequence[0] != '[' || read(STDIN_FILENO, sequence + 1, 1) != 1)
+	{
+		return;
+	}
+	switch (sequence[1])
+	{
+		case 'C':
+			editor->cursor += editor->cursor < editor->length;
+			break;
+		case 'D':
+			editor->cursor -= editor->cursor > 0;
+			break;
+		case 'H':
+			editor->cursor = 0;
+			break;
+		case 'F':
+			editor->cursor = editor->length;
+			break;
+		case '3':
+			// Delete, as '\x1b[3~'
+			if (read(STDIN_FILENO, sequence + 2, 1) == 1 && sequence[2] == '~' && editor->cursor < editor->length)
+			{
+				char *at = editor->buffer + editor->cursor;
+				memmove(at, at + 1, editor->length - editor->cursor - 1);
+				editor->length--;
+			}
+			break;
+	}
+}
+
+
+bool edit_line(Editor *editor, const char *prompt, char **line)
+{
+	if (!reserve_line(editor, 0))
+	{
+		return false;
+	}
+	editor->length = editor->cursor = 0;
+	editor->tabbed = false;
+
+	// Keys are read one by one, the terminal neither echoing them nor handling the signals
+	struct termios raw = editor->saved;
+	raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+	raw.c_iflag &= ~(IXON | ICRNL);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1)
+	{
+		return false;
+	}
+	fflush(stdout);
+	refresh(editor, prompt);
+
+	bool typed = true;
+	while (true)
+	{
+		unsigned char key;
+		ssize_t bytes = read(STDIN_FILENO, &key, 1);
+		if (bytes == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (bytes != 1 || (key == 4 && editor->length == 0))
+		{
+			typed = false;
+			break;
+		}
+		if (key == '\r' || key == '\n')
+		{
+			dprintf(STDOUT_FILENO, "\n");
+			break;
+		}
+		if (key == '\t')
+		{
+			complete(editor, prompt);
+			continue;
+		}
+		editor->tabbed = false;
+
+		switch (key)
+		{
+			case 3:
+				// Ctrl-C drops the line
+				dprintf(STDOUT_FILENO, "^C\n");
+				editor->length = editor->cursor = 0;
+				break;
+			case 4:
+				// Ctrl-D deletes the character under the cursor
+				if (editor->cursor < editor->length)
+				{
+					char *at = editor->buffer + editor->cursor;
+					memmove(at, at + 1, editor->length - editor->cursor - 1);
+					editor->length--;
+				}
+				break;
+			case 127:
+			case 8:
+				if (editor->cursor > 0)
+				{
+					char *at = editor->buffer + editor->cursor;
+					memmove(at - 1, at, editor->length - editor->cursor);
+					editor->length--;
+					editor->cursor--;
+				}
+				break;
+			case 1:
+				editor->cursor = 0;
+				break;
+			case 5:
+				editor->cursor = editor->length;
+				break;
+			case 27:
+				escape_key(editor);
+				break;
+			default:
+				if (key >= ' ')
+				{
+					char character = key;
+					insert_text(editor, &character, 1);
+				}
+				break;
+		}
+		refresh(editor, prompt);
+	}
+	tcsetattr(STDIN_FILENO, TCSADRAIN, &editor->saved);
+	if (!typed)
+	{
+		return false;
+	}
+
+	// Trim the line from both ends, as get_input() does
+	char *first = editor->buffer;
+	char *last = editor->buffer + editor->length;
+	while (first < last && *first == ' ')
+	{
+		first++;
+	}
+	while (last > first && last[-1] == ' ')
+	{
+		last--;
+	}
+	*last = '\0';
+	*line = first;
+	return true;
+}
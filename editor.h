@@ -0,0 +1,119 @@
+/**
+ * Line editor declarations
+ * Command lines typed on a terminal are edited in raw mode, the Tab
+ * key completing the names of the builtins and of the files.
+*/
+#ifndef EDITOR_H
+#define EDITOR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <termios.h>
+#include <sys/types.h>
+
+// Number of candidates displayed at most when a completion is ambiguous
+#define EDITOR_LIST_MAX 100
+
+/**
+ * @brief @struct type for a node of a prefix trie.
+ *
+ * The children of a node are chained through @p sibling , in the
+ * order of their labels, starting from @p child . Index 0 is the root,
+ * which is never a child: 0 means no node. @p words is the number of
+ * names ending in the subtree of the node, @p kind being set on the
+ * node where a name ends.
+*/
+typedef struct trie_node
+{
+	unsigned int child;
+	unsigned int sibling;
+	unsigned int words;
+	char label;
+	unsigned char kind;
+} Trie_node;
+
+/**
+ * @brief @struct type for a prefix trie, its nodes living in a single
+ * array so that a trie of many names is a single allocation.
+*/
+typedef struct trie
+{
+	Trie_node *nodes;
+	unsigned int count;
+	unsigned int capacity;
+} Trie;
+
+/**
+ * @brief @struct type for the state of the line editor.
+ *
+ * The names of the builtins are indexed once. The names of the files
+ * are indexed for one directory at a time, identified by @p device
+ * and @p inode , and watched with inotify: the trie is only built
+ * again once the content of the directory changed.
+*/
+typedef struct editor
+{
+	struct termios saved;
+	// Line being edited
+	char *buffer;
+	size_t length;
+	size_t cursor;
+	size_t size;
+	// Whether the previous key was Tab, to list the candidates
+	bool tabbed;
+	Trie commands;
+	Trie files;
+	bool files_valid;
+	dev_t device;
+	ino_t inode;
+	int inotify;
+	int watch;
+} Editor;
+
+
+/**
+ * bool editor_init(Editor *editor)
+ * @brief Prepare the line editor for the standard input.
+ *
+ * @param[out] editor	Editor to prepare.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if the standard input is not a terminal.
+*/
+bool editor_init(Editor *editor);
+
+
+/**
+ * bool edit_line(Editor *editor, const char *prompt, char **line)
+ * @brief Read a command line typed on the terminal.
+ *
+ * @param[in,out] editor	Editor to use.
+ * @param[in] prompt		Prompt displayed before the line.
+ * @param[out] line			Pointer set to the line.
+ * @return					A boolean stating the outcome of the function.
+ * @retval					true on success.
+ * 							false at the end of the input or on failure.
+ *
+ * The function edit_line() puts the terminal in raw mode while the
+ * line is typed, and restores it before returning. The arrow keys,
+ * Home, End, Backspace and Delete move and edit the line, Ctrl-C
+ * clears it and Ctrl-D on an empty line ends the input. Tab
+ * completes the first word with the name of a builtin, and the
+ * other words with the name of a file. A second Tab displays the
+ * candidates when there are several. As get_input() does, the line
+ * is trimmed and stays valid until the next call.
+*/
+bool edit_line(Editor *editor, const char *prompt, char **line);
+
+
+/**
+ * void editor_free(Editor *editor)
+ * @brief Free the memory and the watch of the editor.
+ *
+ * @param[in] editor	Editor to free.
+ * @return				Nothing.
+*/
+void editor_free(Editor *editor);
+
+
+#endif // EDITOR_H
@@ -0,0 +1,258 @@
+// Background job definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "commands.h"
+#include "utils.h"
+
+
+// Table of the jobs not waited for yet, in the order they were started
+static Job *table = NULL;
+static int job_count = 0;
+static int job_capacity = 0;
+
+// Set by the handler of SIGCHLD, cleared once the jobs are reaped
+static volatile sig_atomic_t children_ended = 0;
+
+
+static void on_sigchld(int signal)
+{
+	(void) signal;
+	children_ended = 1;
+}
+
+
+void jobs_init(void)
+{
+	struct sigaction action = {.sa_handler = on_sigchld, .sa_flags = SA_RESTART | SA_NOCLDSTOP};
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGCHLD, &action, NULL) == -1)
+	{
+		perror("Error: sigaction()");
+	}
+}
+
+
+// Status of a child as run() gives it
+static int exit_status(int status)
+{
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+
+// Join the arguments of a command, the job outliving the command line
+static char *command_text(int argc, char **argv)
+{
+	size_t length = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		length += strlen(argv[i]) + 1;
+	}
+	char *text = malloc(length);
+	if (text == NULL)
+	{
+		return NULL;
+	}
+	char *end = text;
+	for (int i = 0; i < argc; i++)
+	{
+		size_t size = strlen(argv[i]);
+		memcpy(end, argv[i], size);
+		end += size;
+		*end++ = i + 1 < argc ? ' ' : '\0';
+	}
+	return text;
+}
+
+
+// Remove the job @p id from the table once it ended, or every job that ended when @p id is 0
+static void forget_jobs(int id)
+{
+	int kept = 0;
+	for (int i = 0; i < job_count; i++)
+	{
+		Job *job = &table[i];
+		if (job->done && (id == 0 || job->id == id))
+		{
+			free(job->command);
+			continue;
+		}
+		table[kept++] = *job;
+	}
+	job_count = kept;
+}
+
+
+bool job_start(int argc, char **argv)
+{
+	if (job_count == job_capacity)
+	{
+		int capacity = job_capacity ? job_capacity * 2 : 16;
+		Job *entries = realloc(table, capacity * sizeof(Job));
+		if (entries == NULL)
+		{
+			printf("Error: Memory allocation failed\n");
+			return false;
+		}
+		table = entries;
+		job_capacity = capacity;
+	}
+	char *command = command_text(argc, argv);
+	if (command == NULL)
+	{
+		printf("Error: Memory allocation failed\n");
+		return false;
+	}
+
+	// Output of the shell so far must come before the one of the program
+	fflush(stdout);
+	pid_t pid = spawn_program(argv, STDIN_FILENO, STDOUT_FILENO);
+	if (pid == -1)
+	{
+		free(command);
+		return false;
+	}
+
+	// Job IDs start over once every job was announced
+	bool announced = true;
+	for (int i = 0; i < job_count; i++)
+	{
+		announced &= table[i].announced;
+	}
+	if (announced)
+	{
+		forget_jobs(0);
+	}
+	int id = job_count ? table[job_count - 1].id + 1 : 1;
+	table[job_count++] = (Job) {.id = id, .pid = pid, .command = command};
+	printf("[%d] %d\n", id, pid);
+	return true;
+}
+
+
+void jobs_reap(void)
+{
+	if (!children_ended)
+	{
+		return;
+	}
+	// Cleared first, so that a child ending during the loop is not missed
+	children_ended = 0;
+	for (int i = 0; i < job_count; i++)
+	{
+		int status;
+		if (!table[i].done && waitpid(table[i].pid, &status, WNOHANG) == table[i].pid)
+		{
+			table[i].done = true;
+			table[i].status = exit_status(status);
+		}
+	}
+}
+
+
+void jobs_notify(void)
+{
+	jobs_reap();
+	for (int i = 0; i < job_count; i++)
+	{
+		Job *job = &table[i];
+		if (!job->done || job->announced)
+		{
+			continue;
+		}
+		if (job->status == 0)
+		{
+			printf("[%d] Done\t%s\n", job->id, job->command);
+		}
+		else
+		{
+			printf("[%d] Exit %d\t%s\n", job->id, job->status, job->command);
+		}
+		// Kept until it is waited for, or until the next job starts
+		job->announced = true;
+	}
+}
+
+
+void jobs_list(void)
+{
+	jobs_reap();
+	FILE *out = command_output();
+	for (int i = 0; i < job_count; i++)
+	{
+		Job *job = &table[i];
+		if (job->announced)
+		{
+			continue;
+		}
+		if (job->done && job->status == 0)
+		{
+			fprintf(out, "[%d] %d\tDone\t%s\n", job->id, job->pid, job->command);
+		}
+		else if (job->done)
+		{
+			fprintf(out, "[%d] %d\tExit %d\t%s\n", job->id, job->pid, job->status, job->command);
+		}
+		else
+		{
+			fprintf(out, "[%d] %d\tRunning\t%s\n", job->id, job->pid, job->command);
+		}
+	}
+}
+
+
+bool jobs_wait(int id)
+{
+	bool found = id == 0;
+	for (int i = 0; i < job_count; i++)
+	{
+		Job *job = &table[i];
+		if (id != 0 && job->id != id)
+		{
+			continue;
+		}
+		found = true;
+		int status;
+		while (!job->done)
+		{
+			pid_t pid = waitpid(job->pid, &status, 0);
+			if (pid == job->pid)
+			{
+				job->done = true;
+				job->status = exit_status(status);
+			}
+			else if (errno != EINTR)
+			{
+				perror("Error: waitpid()");
+				break;
+			}
+		}
+	}
+	// A job that was waited for leaves the table, announced or not
+	if (found)
+	{
+		forget_jobs(id);
+	}
+	return found;
+}
+
+
+void jobs_free(void)
+{
+	for (int i = 0; i < job_count; i++)
+	{
+		free(table[i].command);
+	}
+	free(table);
+	table = NULL;
+	job_count = job_capacity = 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * Background job declarations
+ * Programs started with '&' run while the shell keeps reading
+ * commands. They are reaped as soon as SIGCHLD reports them, and
+ * announced at the next prompt.
+*/
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * @brief @struct type for a program running in the background.
+ *
+ * @p status is the exit status of the program as run() gives it,
+ * once @p done is set. @p command is the command line, kept to be
+ * displayed by 'jobs'. A job that ended stays in the table once
+ * @p announced , so that 'wait' still finds it.
+*/
+typedef struct job
+{
+	int id;
+	pid_t pid;
+	char *command;
+	bool done;
+	bool announced;
+	int status;
+} Job;
+
+
+/**
+ * void jobs_init(void)
+ * @brief Install the handler of SIGCHLD.
+ *
+ * @return			Nothing.
+ *
+ * The handler only records that a child ended, with SA_RESTART so
+ * that the system calls of the shell are not interrupted by it. The
+ * jobs are reaped by jobs_reap().
+*/
+void jobs_init(void);
+
+
+/**
+ * bool job_start(int argc, char **argv)
+ * @brief Launch a program in the background.
+ *
+ * @param[in] argc	Number of arguments.
+ * @param[in] argv	Path of the program and its arguments.
+ * @return			A boolean stating the outcome of the function.
+ * @retval			true if the program was launched.
+ * 					false if not, an error message being displayed.
+ *
+ * The function job_start() adds the program to the job table and
+ * displays its job ID and process ID, without waiting for it.
+*/
+bool job_start(int argc, char **argv);
+
+
+/**
+ * void jobs_reap(void)
+ * @brief Reap the jobs that ended, without blocking.
+ *
+ * @return			Nothing.
+ *
+ * Nothing is done unless SIGCHLD was received since the last call.
+ * Only the jobs are waited for, so that the children of the builtins
+ * are left to them.
+*/
+void jobs_reap(void);
+
+
+/**
+ * void jobs_notify(void)
+ * @brief Announce the jobs that ended.
+ *
+ * The jobs announced are no longer listed, but stay in the table until
+ * they are waited for, or until a job starts once all of them were
+ * announced.
+ *
+ * @return			Nothing.
+*/
+void jobs_notify(void);
+
+
+/**
+ * void jobs_list(void)
+ * @brief Display the job table.
+ *
+ * @return			Nothing.
+*/
+void jobs_list(void);
+
+
+/**
+ * bool jobs_wait(int id)
+ * @brief Wait for a job, or for all of them, and remove them from the table.
+ *
+ * @param[in] id	Job ID, or 0 for every job. A job that ended, even
+ * 					announced, is found at once.
+ * @return			A boolean stating the outcome of the function.
+ * @retval			true on success.
+ * 					false if there is no such job.
+*/
+bool jobs_wait(int id);
+
+
+/**
+ * void jobs_free(void)
+ * @brief Free the job table, the jobs still running being left as is.
+ *
+ * @return			Nothing.
+*/
+void jobs_free(void);
+
+
+#endif // JOBS_H
@@ -0,0 +1,260 @@
+// Program lookup definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "path.h"
+#include "cache.h"
+#include "utils.h"
+
+
+/**
+ * The builtins of a pipeline run on their own threads: 'hash' may list
+ * or clear the table while a program is looked up on another one.
+*/
+static Program_table table = {0};
+static pthread_rwlock_t table_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static long long modification_time(const char *path)
+{
+	struct stat buf;
+	if (stat(path, &buf) == -1)
+	{
+		return -1;
+	}
+	return buf.st_mtim.tv_sec * 1000000000LL + buf.st_mtim.tv_nsec;
+}
+
+
+// Split the value of $PATH, an empty entry being the working directory
+static bool split_path(const char *value)
+{
+	table.value = strdup(value);
+	table.entries = strdup(value);
+	if (table.value == NULL || table.entries == NULL)
+	{
+		return false;
+	}
+	size_t count = 1;
+	for (const char *c = value; *c != '\0'; c++)
+	{
+		count += *c == ':';
+	}
+	table.directories = malloc(count * sizeof(char *));
+	if (table.directories == NULL)
+	{
+		return false;
+	}
+	char *start = table.entries;
+	table.relative = count;
+	for (size_t i = 0; i < count; i++)
+	{
+		char *end = strchrnul(start, ':');
+		bool last = *end == '\0';
+		*end = '\0';
+		table.directories[i] = start[0] != '\0' ? start : ".";
+		if (start[0] != '/' && table.relative == count)
+		{
+			table.relative = i;
+		}
+		start = end + 1;
+		if (last)
+		{
+			break;
+		}
+	}
+	table.directory_count = count;
+	return true;
+}
+
+
+// Free the table, its lock being held
+static void forget_table(void)
+{
+	for (size_t i = 0; i < table.capacity; i++)
+	{
+		free(table.programs[i].name);
+		free(table.programs[i].path);
+	}
+	free(table.programs);
+	free(table.directories);
+	free(table.entries);
+	free(table.value);
+	memset(&table, 0, sizeof(table));
+}
+
+
+void path_forget(void)
+{
+	pthread_rwlock_wrlock(&table_lock);
+	forget_table();
+	pthread_rwlock_unlock(&table_lock);
+}
+
+
+// Get the slot of a name, the empty slot where it would go if absent
+static Program *find_slot(Program *programs, size_t capacity, const char *name)
+{
+	size_t slot = hash_bytes(name, strlen(name), CACHE_SEED) & (capacity - 1);
+	while (programs[slot].name != NULL && strcmp(programs[slot].name, name))
+	{
+		slot = (slot + 1) & (capacity - 1);
+	}
+	return &programs[slot];
+}
+
+
+// Double the size of the table, so that it stays at most half full
+static bool grow_table(void)
+{
+	size_t capacity = table.capacity ? table.capacity * 2 : 64;
+	Program *programs = calloc(capacity, sizeof(Program));
+	if (programs == NULL)
+	{
+		return false;
+	}
+	for (size_t i = 0; i < table.capacity; i++)
+	{
+		if (table.programs[i].name != NULL)
+		{
+			*find_slot(programs, capacity, table.programs[i].name) = table.programs[i];
+		}
+	}
+	free(table.programs);
+	table.programs = programs;
+	table.capacity = capacity;
+	return true;
+}
+
+
+// Look for the program in each directory of $PATH, in order
+static void search_program(Program *program)
+{
+	free(program->path);
+	program->path = NULL;
+	for (size_t i = 0; i < table.directory_count; i++)
+	{
+		char *path;
+		if (asprintf(&path, "%s/%s", table.directories[i], program->name) == -1)
+		{
+			return;
+		}
+		struct stat buf;
+		if (stat(path, &buf) == 0 && S_ISREG(buf.st_mode) && access(path, X_OK) == 0)
+		{
+			program->path = path;
+			program->directory = i;
+			program->mtime = modification_time(table.directories[i]);
+			return;
+		}
+		free(path);
+	}
+}
+
+
+// Find the program, its lock being held
+static const char *lookup(const char *name)
+{
+	// Another $PATH makes every path found so far doubtful
+	const char *value = getenv("PATH");
+	if (value == NULL)
+	{
+		value = "";
+	}
+	if (table.value == NULL || strcmp(table.value, value))
+	{
+		forget_table();
+		if (!split_path(value))
+		{
+			forget_table();
+			return NULL;
+		}
+	}
+
+	if (table.count * 2 >= table.capacity && !grow_table())
+	{
+		return NULL;
+	}
+	Program *program = find_slot(table.programs, table.capacity, name);
+	if (program->name == NULL)
+	{
+		program->name = strdup(name);
+		if (program->name == NULL)
+		{
+			return NULL;
+		}
+		table.count++;
+		search_program(program);
+	}
+	/**
+	 * Files added, removed or renamed in the directory change its
+	 * modification time. A relative entry, up to the one of the
+	 * program, may name another directory since the last lookup.
+	*/
+	else if (program->path == NULL || program->directory >= table.relative
+		|| modification_time(table.directories[program->directory]) != program->mtime)
+	{
+		search_program(program);
+	}
+	if (program->path != NULL)
+	{
+		program->hits++;
+	}
+	return program->path;
+}
+
+
+const char *path_lookup(const char *name)
+{
+	// Looking up counts a hit, so the table is always written
+	pthread_rwlock_wrlock(&table_lock);
+	const char *found = lookup(name);
+	char *path = NULL;
+	if (found != NULL)
+	{
+		// The table may change as soon as it is released
+		size_t size = strlen(found) + 1;
+		path = arena_alloc(&line_arena, size);
+		if (path != NULL)
+		{
+			memcpy(path, found, size);
+		}
+	}
+	pthread_rwlock_unlock(&table_lock);
+	return path;
+}
+
+
+void path_list(FILE *out)
+{
+	// Gathered first: the lock must not be held while 'out' may block on a pipe
+	char *text = NULL;
+	size_t length = 0;
+	FILE *list = open_memstream(&text, &length);
+	if (list == NULL)
+	{
+		return;
+	}
+	pthread_rwlock_rdlock(&table_lock);
+	for (size_t i = 0; i < table.capacity; i++)
+	{
+		Program *program = &table.programs[i];
+		if (program->path != NULL)
+		{
+			fprintf(list, "%lu\t%s\n", program->hits, program->path);
+		}
+	}
+	pthread_rwlock_unlock(&table_lock);
+	fclose(list);
+
+	fprintf(out, "hits\tcommand\n");
+	fwrite(text, 1, length, out);
+	free(text);
+}
@@ -0,0 +1,92 @@
+/**
+ * Program lookup declarations
+ * Programs named without a slash are searched for in the directories
+ * of $PATH, the paths found being kept in a hash table.
+*/
+#ifndef PATH_H
+#define PATH_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief @struct type for a program found in $PATH.
+ *
+ * @p mtime is the modification time of the directory the program was
+ * found in, at that moment. A directory whose content changed is
+ * searched again. @p path is NULL when the program was not found.
+*/
+typedef struct program
+{
+	char *name;
+	char *path;
+	size_t directory;
+	long long mtime;
+	unsigned long hits;
+} Program;
+
+/**
+ * @brief @struct type for the table of the programs looked up.
+ *
+ * The table is indexed by open addressing, with a load factor of at
+ * most 1/2. @p value is the value of $PATH the table was filled
+ * from, and @p directories its entries, cut from a copy of it.
+ * @p relative is the index of its first entry relative to the working
+ * directory, an empty one included, or @p directory_count if none is.
+*/
+typedef struct program_table
+{
+	Program *programs;
+	size_t count;
+	size_t capacity;
+	char *value;
+	char *entries;
+	char **directories;
+	size_t directory_count;
+	size_t relative;
+} Program_table;
+
+
+/**
+ * const char *path_lookup(const char *name)
+ * @brief Find the file of a program in the directories of $PATH.
+ *
+ * @param[in] name	Name of the program.
+ * @return			Path of the program file.
+ * @retval			'char' pointer, valid until the end of the command line.
+ * 					NULL pointer if the program is not found.
+ *
+ * The function path_lookup() looks @p name up in the table first. A
+ * program found before is only checked with a single stat() of its
+ * directory, instead of looking for the file in every directory.
+ * The table is cleared when the value of $PATH changes. The entries
+ * relative to the working directory may name another directory after
+ * 'cd': a program found in one of them, or after one of them, is
+ * searched for again at each lookup. The table is shared
+ * by the threads of a pipeline, behind a lock, and the path returned
+ * is a copy taken from the arena of the command line.
+*/
+const char *path_lookup(const char *name);
+
+
+/**
+ * void path_forget(void)
+ * @brief Clear the table of the programs looked up.
+ *
+ * @return			Nothing.
+*/
+void path_forget(void);
+
+
+/**
+ * void path_list(FILE *out)
+ * @brief Display the programs of the table and their number of hits.
+ *
+ * @param[in] out	Stream to display the table to.
+ * @return			Nothing.
+*/
+void path_list(FILE *out);
+
+
+#endif // PATH_H
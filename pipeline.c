@@ -0,0 +1,178 @@
+// Pipeline definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "utils.h"
+
+
+// Run a builtin with the ends of the pipes of its stage as streams
+static void *run_stage(void *arg)
+{
+	Stage *stage = arg;
+	streams.in = stage->in;
+	streams.out = stage->out == STDOUT_FILENO ? NULL : fdopen(stage->out, "w");
+	if (stage->out != STDOUT_FILENO && streams.out == NULL)
+	{
+		fprintf(stderr, "Error: %s: Cannot open the pipe: %m\n", stage->argv[0]);
+		close(stage->out);
+	}
+	else
+	{
+		stage->command->handler(stage->argc, stage->argv);
+	}
+
+	// The next command sees the end of its input once the stream is closed
+	if (streams.out != NULL)
+	{
+		fclose(streams.out);
+	}
+	else
+	{
+		fflush(stdout);
+	}
+	if (stage->in != STDIN_FILENO)
+	{
+		close(stage->in);
+	}
+	arena_free(&line_arena);
+	return NULL;
+}
+
+
+// Close the file descriptors a stage was given, when it cannot run
+static void close_stage(Stage *stage)
+{
+	if (stage->in != STDIN_FILENO)
+	{
+		close(stage->in);
+	}
+	if (stage->out != STDOUT_FILENO)
+	{
+		close(stage->out);
+	}
+}
+
+
+int run_pipeline(int argc, char **argv)
+{
+	int count = 1;
+	for (int i = 0; i < argc; i++)
+	{
+		count += argv[i] == NULL;
+	}
+	Stage *stages = arena_alloc(&line_arena, count * sizeof(Stage));
+	if (stages == NULL)
+	{
+		printf("Error: Memory allocation failed\n");
+		return 1;
+	}
+
+	// Every command is checked before any of them is launched
+	int start = 0;
+	for (int i = 0; i < count; i++)
+	{
+		Stage *stage = &stages[i];
+		int end = start;
+		while (end < argc && argv[end] != NULL)
+		{
+			end++;
+		}
+		*stage = (Stage) {.argc = end - start, .argv = argv + start, .pid = -1};
+		start = end + 1;
+
+		if (stage->argc == 0)
+		{
+			printf("Error: Missing command in pipeline\n");
+			return 2;
+		}
+		stage->command = find_command(stage->argv[0]);
+		if (stage->command != NULL)
+		{
+			if (!check_stage(stage->command, stage->argc, stage->argv)
+				|| !check_arguments(stage->command, stage->argc, stage->argv))
+			{
+				return 2;
+			}
+		}
+	}
+
+	/**
+	 * The pipes are all created first. Their ends are closed on exec,
+	 * so that a program only keeps the two it is given: a program
+	 * holding the write end of its own input would never see it end.
+	*/
+	stages[0].in = STDIN_FILENO;
+	stages[count - 1].out = STDOUT_FILENO;
+	for (int i = 0; i + 1 < count; i++)
+	{
+		int ends[2];
+		if (pipe2(ends, O_CLOEXEC) == -1)
+		{
+			perror("Error: pipe2()");
+			for (int j = 0; j < i; j++)
+			{
+				close_stage(&stages[j]);
+			}
+			if (i > 0)
+			{
+				close(stages[i].in);
+			}
+			return 1;
+		}
+		stages[i].out = ends[1];
+		stages[i + 1].in = ends[0];
+	}
+
+	// Output of the shell so far must come before the one of the commands
+	fflush(stdout);
+	for (int i = 0; i < count; i++)
+	{
+		Stage *stage = &stages[i];
+		if (stage->command != NULL)
+		{
+			stage->started = pthread_create(&stage->thread, NULL, run_stage, stage) == 0;
+			if (!stage->started)
+			{
+				fprintf(stderr, "Error: %s: Cannot start the thread\n", stage->argv[0]);
+				close_stage(stage);
+			}
+			continue;
+		}
+
+		// The program has its own copies of the ends, the shell does not need them
+		stage->pid = spawn_program(stage->argv, stage->in, stage->out);
+		if (stage->pid == -1)
+		{
+			stage->status = errno == ENOENT ? 127 : 126;
+		}
+		close_stage(stage);
+	}
+
+	// The status is the one of the last command, as in other shells
+	int status = 0;
+	for (int i = 0; i < count; i++)
+	{
+		Stage *stage = &stages[i];
+		if (stage->command != NULL)
+		{
+			if (stage->started)
+			{
+				pthread_join(stage->thread, NULL);
+			}
+			status = stage->started ? 0 : 1;
+		}
+		else
+		{
+			status = stage->pid == -1 ? stage->status : wait_program(stage->pid, NULL);
+		}
+	}
+	return status;
+}
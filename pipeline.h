@@ -0,0 +1,61 @@
+/**
+ * Pipeline declarations
+ * The commands of a pipeline run at once, the output of each one
+ * being the input of the next one through a pipe.
+*/
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "commands.h"
+
+/**
+ * @brief @struct type for a command of a pipeline.
+ *
+ * A builtin command runs on a thread of the shell, with @p in and
+ * @p out as its streams. A program file runs in its own process.
+ * The file descriptors belong to the stage: the thread closes them
+ * when the builtin returns, and the shell once the program launched.
+*/
+typedef struct stage
+{
+	const Command *command;
+	int argc;
+	char **argv;
+	int in;
+	int out;
+	pthread_t thread;
+	bool started;
+	pid_t pid;
+	// Status of a program that could not be launched
+	int status;
+} Stage;
+
+
+/**
+ * int run_pipeline(int argc, char **argv)
+ * @brief Run the commands of a pipeline.
+ *
+ * @param[in] argc		Number of arguments, separators included.
+ * @param[in] argv		Arguments of the commands, each command
+ * 						ending with a NULL pointer.
+ * @return				Exit status of the pipeline.
+ * @retval				Exit status of the last command, 0 for a builtin.
+ * 						2 if a command is empty or invalid.
+ * 						127 if the last command cannot be found.
+ *
+ * The function run_pipeline() checks every command before launching
+ * any of them. Each command may be a program file or a builtin, apart
+ * from those changing or reading the state of the shell: 'exit', 'cd',
+ * 'jobs', 'wait' and 'rm -i'. The pipes are created with pipe2(). The builtins
+ * write to them with stdio, while cat moves its data with splice()
+ * so that it does not go through the memory of the shell. The
+ * function returns once all the commands ended.
+*/
+int run_pipeline(int argc, char **argv);
+
+
+#endif // PIPELINE_H
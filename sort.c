@@ -0,0 +1,530 @@
+// External merge sort definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "sort.h"
+#include "utils.h"
+
+
+/**
+ * Size taken by a record, name included. It is rounded up so that the
+ * records following each other in memory or on disk stay aligned.
+*/
+static size_t record_size(size_t length)
+{
+	return (sizeof(Record) + length + 1 + 7) & ~(size_t) 7;
+}
+
+
+// Write a whole buffer at the given offset of a file
+static bool write_at(int fd, const char *data, size_t size, long long offset)
+{
+	while (size > 0)
+	{
+		ssize_t bytes = pwrite(fd, data, size, offset);
+		if (bytes == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (bytes == -1)
+		{
+			perror("Error: Cannot write sorted run");
+			return false;
+		}
+		data += bytes;
+		size -= bytes;
+		offset += bytes;
+	}
+	return true;
+}
+
+
+// qsort_r() comparison of two record pointers
+static int compare_pointers(const void *a, const void *b, void *context)
+{
+	Compare *compare = context;
+	return (*compare)(*(Record * const *) a, *(Record * const *) b);
+}
+
+
+/**
+ * @brief @struct type to append records to the temporary file as a
+ * new run, through a buffer.
+*/
+typedef struct writer
+{
+	int fd;
+	char *buffer;
+	size_t used;
+	long long offset;
+	size_t count;
+	bool failed;
+} Writer;
+
+
+// Start a run at the end of the temporary file
+static bool writer_open(Writer *writer, Sorter *sorter)
+{
+	memset(writer, 0, sizeof(Writer));
+	writer->fd = sorter->fd;
+	writer->offset = sorter->file_size;
+	writer->buffer = malloc(SIZE_RUN_BUFFER);
+	if (writer->buffer == NULL)
+	{
+		fprintf(command_output(), "Error: Run allocation failed\n");
+		return false;
+	}
+	return true;
+}
+
+
+// Add a record to the run, writing the buffer once full
+static void write_record(const Record *record, void *context)
+{
+	Writer *writer = context;
+	size_t size = record_size(record->length);
+	if (writer->failed)
+	{
+		return;
+	}
+	if (writer->used + size > SIZE_RUN_BUFFER)
+	{
+		writer->failed = !write_at(writer->fd, writer->buffer, writer->used, writer->offset);
+		writer->offset += writer->used;
+		writer->used = 0;
+	}
+	memcpy(writer->buffer + writer->used, record, size);
+	writer->used += size;
+	writer->count++;
+}
+
+
+// Write what is left in the buffer and record the run written
+static bool writer_close(Writer *writer, Sorter *sorter, Run *run)
+{
+	if (!writer->failed)
+	{
+		writer->failed = !write_at(writer->fd, writer->buffer, writer->used, writer->offset);
+		writer->offset += writer->used;
+	}
+	free(writer->buffer);
+	if (writer->failed)
+	{
+		return false;
+	}
+	run->offset = sorter->file_size;
+	run->size = writer->offset - sorter->file_size;
+	run->count = writer->count;
+	sorter->file_size = writer->offset;
+	return true;
+}
+
+
+/**
+ * Sort the records held in memory and append them to the temporary
+ * file as a new run. The memory is then available again.
+*/
+static bool spill(Sorter *sorter)
+{
+	if (sorter->fd == -1)
+	{
+		FILE *file = tmpfile();
+		if (file == NULL)
+		{
+			perror("Error: tmpfile()");
+			return false;
+		}
+		// Only the descriptor is used, it stays valid once duplicated
+		sorter->fd = dup(fileno(file));
+		fclose(file);
+		if (sorter->fd == -1)
+		{
+			perror("Error: dup()");
+			return false;
+		}
+	}
+
+	Run *runs = realloc(sorter->runs, (sorter->runs_count + 1) * sizeof(Run));
+	if (runs == NULL)
+	{
+		fprintf(command_output(), "Error: Run allocation failed\n");
+		return false;
+	}
+	sorter->runs = runs;
+
+	qsort_r(sorter->records, sorter->count, sizeof(Record *), compare_pointers, &sorter->compare);
+
+	Writer writer;
+	if (!writer_open(&writer, sorter))
+	{
+		return false;
+	}
+	for (size_t i = 0; i < sorter->count; i++)
+	{
+		write_record(sorter->records[i], &writer);
+	}
+	if (!writer_close(&writer, sorter, &sorter->runs[sorter->runs_count]))
+	{
+		return false;
+	}
+	sorter->runs_count++;
+	sorter->data_used = 0;
+	sorter->count = 0;
+	return true;
+}
+
+
+void sorter_init(Sorter *sorter, Compare compare, size_t budget)
+{
+	memset(sorter, 0, sizeof(Sorter));
+	sorter->compare = compare;
+	if (budget < SORT_MIN_BUDGET)
+	{
+		budget = SORT_MIN_BUDGET;
+	}
+	// The buffer writing a run is taken from the budget
+	sorter->budget = budget - SIZE_RUN_BUFFER;
+	// A merge reads from that many runs, plus the run it writes
+	sorter->fan_in = budget / SIZE_RUN_BUFFER - 1;
+	sorter->fd = -1;
+}
+
+
+bool sorter_add(Sorter *sorter, const Record *fields, const char *name)
+{
+	size_t length = strlen(name);
+	size_t size = record_size(length);
+
+	// Both the record and its pointer count against the budget
+	size_t needed = sorter->data_used + size + (sorter->count + 1) * sizeof(Record *);
+	if (needed > sorter->budget && sorter->count > 0)
+	{
+		if (!spill(sorter))
+		{
+			return false;
+		}
+	}
+
+	// Grow the memory areas, within the budget
+	if (sorter->data_used + size > sorter->data_size)
+	{
+		size_t data_size = sorter->data_size ? sorter->data_size * 2 : 64 * 1024;
+		while (data_size < sorter->data_used + size)
+		{
+			data_size *= 2;
+		}
+		// Doubling must not take both areas past the budget; only a record
+		// larger than the budget on its own may exceed it
+		size_t records_bytes = sorter->records_size * sizeof(Record *);
+		size_t room = sorter->budget > records_bytes ? sorter->budget - records_bytes : 0;
+		if (data_size > room)
+		{
+			data_size = room > sorter->data_used + size ? room : sorter->data_used + size;
+		}
+		char *data = realloc(sorter->data, data_size);
+		if (data == NULL)
+		{
+			fprintf(command_output(), "Error: Sort memory allocation failed\n");
+			return false;
+		}
+		// The record pointers follow the data area
+		for (size_t i = 0; i < sorter->count; i++)
+		{
+			sorter->records[i] = (Record *) (data + ((char *) sorter->records[i] - sorter->data));
+		}
+		sorter->data = data;
+		sorter->data_size = data_size;
+	}
+	if (sorter->count == sorter->records_size)
+	{
+		size_t records_size = sorter->records_size ? sorter->records_size * 2 : 1024;
+		size_t room = sorter->budget > sorter->data_size ? (sorter->budget - sorter->data_size) / sizeof(Record *) : 0;
+		if (records_size > room)
+		{
+			records_size = room > sorter->count + 1 ? room : sorter->count + 1;
+		}
+		Record **records = realloc(sorter->records, records_size * sizeof(Record *));
+		if (records == NULL)
+		{
+			fprintf(command_output(), "Error: Sort memory allocation failed\n");
+			return false;
+		}
+		sorter->records = records;
+		sorter->records_size = records_size;
+	}
+
+	Record *record = (Record *) (sorter->data + sorter->data_used);
+	*record = *fields;
+	record->length = length;
+	memcpy(record->name, name, length + 1);
+	sorter->records[sorter->count++] = record;
+	sorter->data_used += size;
+	return true;
+}
+
+
+/**
+ * @brief @struct type to read the records of a run back, through a
+ * buffer.
+*/
+typedef struct cursor
+{
+	char *buffer;
+	size_t start;
+	size_t end;
+	long long offset;
+	long long limit;
+	size_t remaining;
+	Record *current;
+} Cursor;
+
+
+// Make sure @p size bytes of the run are available in the buffer
+static bool cursor_fill(Cursor *cursor, int fd, size_t size)
+{
+	if (cursor->end - cursor->start >= size)
+	{
+		return true;
+	}
+	memmove(cursor->buffer, cursor->buffer + cursor->start, cursor->end - cursor->start);
+	cursor->end -= cursor->start;
+	cursor->start = 0;
+
+	while (cursor->end < size)
+	{
+		size_t wanted = SIZE_RUN_BUFFER - cursor->end;
+		if ((long long) wanted > cursor->limit - cursor->offset)
+		{
+			wanted = cursor->limit - cursor->offset;
+		}
+		ssize_t bytes = pread(fd, cursor->buffer + cursor->end, wanted, cursor->offset);
+		if (bytes == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (bytes == -1)
+		{
+			perror("Error: Cannot read sorted run");
+			return false;
+		}
+		if (bytes == 0)
+		{
+			fprintf(command_output(), "Error: Sorted run is truncated\n");
+			return false;
+		}
+		cursor->end += bytes;
+		cursor->offset += bytes;
+	}
+	return true;
+}
+
+
+// Move to the next record of a run, 'current' being NULL at its end
+static bool cursor_next(Cursor *cursor, int fd)
+{
+	if (cursor->current != NULL)
+	{
+		cursor->start += record_size(cursor->current->length);
+		cursor->current = NULL;
+	}
+	if (cursor->remaining == 0)
+	{
+		return true;
+	}
+	if (!cursor_fill(cursor, fd, sizeof(Record)))
+	{
+		return false;
+	}
+	Record *record = (Record *) (cursor->buffer + cursor->start);
+	if (!cursor_fill(cursor, fd, record_size(record->length)))
+	{
+		return false;
+	}
+	cursor->current = (Record *) (cursor->buffer + cursor->start);
+	cursor->remaining--;
+	return true;
+}
+
+
+// Restore the heap order from position @p i downwards
+static void sift_down(Cursor **heap, size_t count, size_t i, Compare compare)
+{
+	while (true)
+	{
+		size_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+		if (left < count && compare(heap[left]->current, heap[smallest]->current) < 0)
+		{
+			smallest = left;
+		}
+		if (right < count && compare(heap[right]->current, heap[smallest]->current) < 0)
+		{
+			smallest = right;
+		}
+		if (smallest == i)
+		{
+			return;
+		}
+		Cursor *swap = heap[i];
+		heap[i] = heap[smallest];
+		heap[smallest] = swap;
+		i = smallest;
+	}
+}
+
+
+// Merge @p count runs from @p first on, giving each record to @p emit in order
+static bool merge_runs(Sorter *sorter, size_t first, size_t count, Emit emit, void *context)
+{
+	Cursor *cursors = calloc(count, sizeof(Cursor));
+	Cursor **heap = calloc(count, sizeof(Cursor *));
+	bool success = cursors != NULL && heap != NULL;
+	if (!success)
+	{
+		fprintf(command_output(), "Error: Merge memory allocation failed\n");
+	}
+
+	size_t heap_count = 0;
+	for (size_t i = 0; success && i < count; i++)
+	{
+		const Run *run = &sorter->runs[first + i];
+		cursors[i].buffer = malloc(SIZE_RUN_BUFFER);
+		if (cursors[i].buffer == NULL)
+		{
+			fprintf(command_output(), "Error: Merge memory allocation failed\n");
+			success = false;
+			break;
+		}
+		cursors[i].offset = run->offset;
+		cursors[i].limit = run->offset + run->size;
+		cursors[i].remaining = run->count;
+		success = cursor_next(&cursors[i], sorter->fd);
+		if (success && cursors[i].current != NULL)
+		{
+			heap[heap_count++] = &cursors[i];
+		}
+	}
+	for (size_t i = heap_count / 2; success && i-- > 0;)
+	{
+		sift_down(heap, heap_count, i, sorter->compare);
+	}
+
+	// Output the smallest record, then replace it by the next of its run
+	while (success && heap_count > 0)
+	{
+		emit(heap[0]->current, context);
+		success = cursor_next(heap[0], sorter->fd);
+		if (heap[0]->current == NULL)
+		{
+			heap[0] = heap[--heap_count];
+		}
+		sift_down(heap, heap_count, 0, sorter->compare);
+	}
+
+	for (size_t i = 0; cursors != NULL && i < count; i++)
+	{
+		free(cursors[i].buffer);
+	}
+	free(cursors);
+	free(heap);
+	return success;
+}
+
+
+/**
+ * Merge groups of runs into longer runs, appended to the temporary
+ * file, until few enough are left for their buffers to fit in the
+ * budget at once.
+*/
+static bool merge_pass(Sorter *sorter)
+{
+	size_t count = (sorter->runs_count + sorter->fan_in - 1) / sorter->fan_in;
+	Run *merged = malloc(count * sizeof(Run));
+	if (merged == NULL)
+	{
+		fprintf(command_output(), "Error: Merge memory allocation failed\n");
+		return false;
+	}
+	for (size_t i = 0, first = 0; i < count; i++, first += sorter->fan_in)
+	{
+		size_t group = sorter->runs_count - first < sorter->fan_in ? sorter->runs_count - first : sorter->fan_in;
+		if (group == 1)
+		{
+			merged[i] = sorter->runs[first];
+			continue;
+		}
+		Writer writer;
+		if (!writer_open(&writer, sorter))
+		{
+			free(merged);
+			return false;
+		}
+		bool success = merge_runs(sorter, first, group, write_record, &writer);
+		if (!writer_close(&writer, sorter, &merged[i]) || !success)
+		{
+			free(merged);
+			return false;
+		}
+	}
+	free(sorter->runs);
+	sorter->runs = merged;
+	sorter->runs_count = count;
+	return true;
+}
+
+
+bool sorter_finish(Sorter *sorter, Emit emit, void *context)
+{
+	// Everything fits in memory: no file is involved
+	if (sorter->runs_count == 0)
+	{
+		if (sorter->count > 0)
+		{
+			qsort_r(sorter->records, sorter->count, sizeof(Record *), compare_pointers, &sorter->compare);
+		}
+		for (size_t i = 0; i < sorter->count; i++)
+		{
+			emit(sorter->records[i], context);
+		}
+		return true;
+	}
+
+	if (sorter->count > 0 && !spill(sorter))
+	{
+		return false;
+	}
+	// The memory of the first phase is not needed anymore
+	free(sorter->data);
+	free(sorter->records);
+	sorter->data = NULL;
+	sorter->records = NULL;
+	sorter->data_size = sorter->records_size = 0;
+
+	while (sorter->runs_count > sorter->fan_in)
+	{
+		if (!merge_pass(sorter))
+		{
+			return false;
+		}
+	}
+	return merge_runs(sorter, 0, sorter->runs_count, emit, context);
+}
+
+
+void sorter_free(Sorter *sorter)
+{
+	free(sorter->data);
+	free(sorter->records);
+	free(sorter->runs);
+	if (sorter->fd != -1)
+	{
+		close(sorter->fd);
+	}
+	memset(sorter, 0, sizeof(Sorter));
+	sorter->fd = -1;
+}
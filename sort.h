@@ -0,0 +1,152 @@
+/**
+ * External merge sort declarations
+ * Sorts directory entries within a bounded amount of memory
+*/
+#ifndef SORT_H
+#define SORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Default memory used to sort entries, buffers of the runs on disk included
+#ifndef SORT_BUDGET
+#define SORT_BUDGET (64 * 1024 * 1024)
+#endif
+// Size of the buffer of each sorted run written or read during the merge
+#define SIZE_RUN_BUFFER (64 * 1024)
+// Smallest budget, enough to merge two runs into a third one
+#define SORT_MIN_BUDGET (3 * SIZE_RUN_BUFFER)
+
+/**
+ * @brief @struct type to store a directory entry to sort.
+ * 
+ * The name is stored right after the fixed fields, null-terminated,
+ * so that a record can be written to and read from a file as is.
+ * The modification time is given in nanoseconds.
+*/
+typedef struct record
+{
+	long long size;
+	long long mtime;
+	unsigned int mode;
+	unsigned int length;
+	char name[];
+} Record;
+
+/**
+ * @brief Function type comparing two records, following the
+ * convention of qsort().
+*/
+typedef int (*Compare)(const Record *a, const Record *b);
+
+/**
+ * @brief Function type receiving the records in sorted order.
+*/
+typedef void (*Emit)(const Record *record, void *context);
+
+/**
+ * @brief @struct type of a sorted run spilled to disk.
+*/
+typedef struct run
+{
+	long long offset;
+	long long size;
+	size_t count;
+} Run;
+
+/**
+ * @brief @struct type for an external merge sort.
+ * 
+ * Records are gathered in memory until @p budget bytes are used.
+ * They are then sorted and written to a temporary file as a sorted
+ * run. Once all records are added, the runs are merged together,
+ * @p fan_in at most at once.
+*/
+typedef struct sorter
+{
+	Compare compare;
+	size_t budget;
+	size_t fan_in;
+	// Records currently held in memory
+	char *data;
+	size_t data_size;
+	size_t data_used;
+	Record **records;
+	size_t records_size;
+	size_t count;
+	// Sorted runs written to the temporary file
+	int fd;
+	long long file_size;
+	Run *runs;
+	size_t runs_count;
+} Sorter;
+
+
+/**
+ * void sorter_init(Sorter *sorter, Compare compare, size_t budget)
+ * @brief Prepare a sorter.
+ * 
+ * @param[out] sorter	Sorter to initialize.
+ * @param[in] compare	Function giving the order of the records.
+ * @param[in] budget	Memory allowed for the records held in memory
+ * 						and the buffers of the runs, raised to
+ * 						SORT_MIN_BUDGET if lower.
+ * @return				Nothing.
+*/
+void sorter_init(Sorter *sorter, Compare compare, size_t budget);
+
+
+/**
+ * bool sorter_add(Sorter *sorter, const Record *fields, const char *name)
+ * @brief Add a record to sort.
+ * 
+ * @param[in] sorter	Sorter to add the record to.
+ * @param[in] fields	Record holding the fields to sort on.
+ * @param[in] name		Name of the entry.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false on failure.
+ * 
+ * The function sorter_add() accepts a pointer @p sorter , a pointer
+ * @p fields and a character pointer @p name as input. It copies the
+ * fields and the name into the memory of @p sorter . If the memory
+ * budget is reached, the records held in memory are first sorted and
+ * written to a temporary file.
+*/
+bool sorter_add(Sorter *sorter, const Record *fields, const char *name);
+
+
+/**
+ * bool sorter_finish(Sorter *sorter, Emit emit, void *context)
+ * @brief Output all the records in sorted order.
+ * 
+ * @param[in] sorter	Sorter holding the records.
+ * @param[in] emit		Function called for each record.
+ * @param[in] context	Pointer given to @p emit .
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false on failure.
+ * 
+ * The function sorter_finish() accepts a pointer @p sorter , a
+ * function @p emit and a pointer @p context as input. If nothing was
+ * written to disk, the records are sorted in memory. Otherwise, the
+ * runs are merged with a heap and each record is given to @p emit
+ * as soon as it is known to be the next one. Each run being read
+ * through a buffer of SIZE_RUN_BUFFER bytes, runs too many for their
+ * buffers to fit in the budget are first merged by groups into
+ * longer runs, in as many passes as needed.
+*/
+bool sorter_finish(Sorter *sorter, Emit emit, void *context);
+
+
+/**
+ * void sorter_free(Sorter *sorter)
+ * @brief Free the memory and the temporary file of a sorter.
+ * 
+ * @param[in] sorter	Sorter to free.
+ * @return				Nothing.
+*/
+void sorter_free(Sorter *sorter);
+
+
+#endif // SORT_H
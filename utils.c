@@ -1,217 +1,542 @@
 // Utility functions defintions
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <sys/dir.h>
 
 #include "utils.h"
+#include "walker.h"
+
 
+Reader stdin_reader = {.fd = STDIN_FILENO};
+__thread Arena line_arena = {0};
+__thread Streams streams = {0};
+Cwd cwd = {.fd = AT_FDCWD};
 
-bool get_input(char *ptr)
+
+static bool is_blank(char character)
 {
-	char character = '\0';
-	int index = 0;
-	memset(ptr, 0, SIZE_INPUT);
-
-	// Fetch input
-    while ((character = getchar()) != '\n')
-    {
-		// The input is too long
-		if (index > SIZE_INPUT - 1)
-		{
-			// Empty the buffer
-			while (getchar() != '\n');
-			printf("Error: Command size exceeded (%i characters max.)\n", SIZE_INPUT);
+	return character == ' ' || character == '\t' || character == '\r';
+}
+
 
+/**
+ * Make room at the end of the reader's buffer. Data already consumed
+ * is dropped first, and the buffer doubles in size if it is still
+ * full.
+*/
+static bool make_room(Reader *reader)
+{
+	if (reader->start > 0)
+	{
+		memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+	if (reader->end == reader->size)
+	{
+		size_t size = reader->size ? reader->size * 2 : SIZE_INPUT;
+		char *buffer = realloc(reader->buffer, size);
+		if (buffer == NULL)
+		{
+			printf("Error: get_input(): Buffer allocation failed\n");
 			return false;
 		}
-		ptr[index] = character;
-		index++;
-    }
-	int len = strlen(ptr);
+		reader->buffer = buffer;
+		reader->size = size;
+	}
+	return true;
+}
 
-	// If no input
-	if (!len)
+
+/**
+ * Read more data at the end of the reader's buffer. Returns the number
+ * of bytes read, 0 at the end of the input, or -1 on failure.
+*/
+static ssize_t fill_reader(Reader *reader)
+{
+	if (!make_room(reader))
 	{
-		return false;
+		return -1;
 	}
 
-	/**
-	 * Input post-process.
-	 * 1st 'for' loop: Getting first character position
-	 * 2nd 'for' loop: Sorting all characters to the left of the array
-	 * 3rd 'for' loop: Removing trailing whitespaces
-	*/
-	int start_index = 0;
-	for (int i = 0; i < len; i++)
+	ssize_t bytes;
+	do
+	{
+		bytes = read(reader->fd, reader->buffer + reader->end, reader->size - reader->end);
+	} while (bytes == -1 && errno == EINTR);
+
+	if (bytes == -1)
+	{
+		perror("Error: read()");
+	}
+	else if (bytes > 0)
 	{
-		if (ptr[i] != ' ') 
+		reader->end += bytes;
+	}
+	return bytes;
+}
+
+
+bool get_input(Reader *reader, char **line)
+{
+	// Bytes of the buffer already searched for a newline character
+	size_t scanned = 0;
+	char *newline = NULL;
+
+	while (true)
+	{
+		char *data = reader->buffer + reader->start;
+		size_t length = reader->end - reader->start;
+		if (length > scanned)
+		{
+			newline = memchr(data + scanned, '\n', length - scanned);
+		}
+		if (newline != NULL || reader->eof)
 		{
-			start_index = i;
 			break;
 		}
-	}
-	for (int i = start_index; i < len + start_index; i++)
-	{
-		if (i > len + 1)
+		scanned = length;
+
+		ssize_t bytes = fill_reader(reader);
+		if (bytes == -1)
 		{
-			ptr[i - start_index] = ' ';
-			continue;
+			return false;
+		}
+		if (bytes == 0)
+		{
+			reader->eof = true;
 		}
-		ptr[i - start_index] = ptr[i];
 	}
-	for (int i = strlen(ptr) - 1; i >= 0; i--)
+
+	char *first = reader->buffer + reader->start;
+	char *last = newline;
+	if (newline == NULL)
 	{
-		if (ptr[i] != ' ') 
+		// End of input: return the unterminated last line, if any
+		if (reader->start == reader->end)
 		{
-			break;
+			return false;
+		}
+		// The buffer always keeps a free byte for the terminator
+		if (reader->end == reader->size && !make_room(reader))
+		{
+			return false;
 		}
-		ptr[i] = '\0';
+		first = reader->buffer + reader->start;
+		last = reader->buffer + reader->end;
+		reader->start = reader->end;
+	}
+	else
+	{
+		reader->start = newline - reader->buffer + 1;
 	}
+
+	// Trim the line from both ends
+	while (first < last && is_blank(*first))
+	{
+		first++;
+	}
+	while (last > first && is_blank(last[-1]))
+	{
+		last--;
+	}
+	*last = '\0';
+	*line = first;
 	return true;
 }
 
 
-Token *parse_input(char *ptr)
+/**
+ * Make sure the argument array can hold @p count pointers. The array
+ * doubles in size when it is too small, the previous one being left
+ * to the arena.
+*/
+static bool reserve_args(Args *args, int count)
 {
-	bool marks = false, parsing = false;
-	int index_buffer = 0;
-
-	// This buffer will be used during parsing
-	char *buffer = calloc(SIZE_INPUT, sizeof(char));
-	if (buffer == NULL)
+	if (count <= args->capacity)
 	{
-		printf("Error: parse_input(): Buffer memory allocation failed\n");
-		return NULL;
+		return true;
 	}
-
-	// Create head of linked-list
-	Token *head = calloc(1, sizeof(Token));
-	if (head == NULL)
+	int capacity = args->capacity ? args->capacity : 16;
+	while (capacity < count)
+	{
+		capacity *= 2;
+	}
+	char **argv = arena_alloc(&line_arena, capacity * sizeof(char *));
+	if (argv == NULL)
+	{
+		printf("Error: parse_input(): Argument array allocation failed\n");
+		return false;
+	}
+	if (args->argc)
 	{
-		printf("Error: parse_input(): 'head' token creation failed\n");
-		return NULL;
+		memcpy(argv, args->argv, args->argc * sizeof(char *));
 	}
+	args->argv = argv;
+	args->capacity = capacity;
+	return true;
+}
+
+
+bool parse_input(char *ptr, Args *args)
+{
+	bool marks = false, parsing = false;
+	args->argc = 0;
+	args->argv = NULL;
+	args->capacity = 0;
+	args->pipes = 0;
+	args->background = false;
 
-	// Parsing loop
-	for (int i = 0; i < (int) strlen(ptr); i++)
+	/**
+	 * Quotation marks are dropped by writing each kept character
+	 * back at 'write', which never gets ahead of 'read'. The input
+	 * buffer can therefore be rewritten in place.
+	*/
+	char *write = ptr;
+	for (char *read = ptr; *read != '\0'; read++)
 	{
-		/**
-		 * If we have a space, if we were not parsing, and if we're
-		 * not within quotation marks: argument found.
-		*/
-		if ((ptr[i] == ' ' && !parsing && !marks) ||
-			(i == (int) strlen(ptr) - 1))
-		{	
-			parsing = true;
-			/**
-			 * Several possibilities, in order:
-			 * 	1. This is the last argument of the command line
-			 * 	2. This is the first argument of the command line
-			 * 	3. Nor the first, nor the last argument.
-			*/
-			if ((i == (int) strlen(ptr) - 1) && ptr[i] != '"')
+		// Nothing may follow the ampersand sending the line to the background
+		if (args->background && *read != ' ')
+		{
+			printf("Error: parse_input(): '&' must end the command line\n");
+			return false;
+		}
+
+		// A space outside of quotation marks ends the current argument
+		if (*read == ' ' && !marks)
+		{
+			if (parsing)
 			{
-				buffer[index_buffer] = ptr[i];
+				*write++ = '\0';
+				parsing = false;
 			}
-			/**
-			 * No 'else if' here, as an argument can be both the 
-			 * first and last of the command line.
-			*/
-			if (head->argument[0] == '\0')
+			continue;
+		}
+
+		// An ampersand outside of quotation marks ends the command line
+		if (*read == '&' && !marks)
+		{
+			if (parsing)
 			{
-				strcpy(head->argument, buffer);
+				*write++ = '\0';
+				parsing = false;
 			}
-			else
+			args->background = true;
+			continue;
+		}
+
+		// A vertical bar outside of quotation marks ends the current command
+		if (*read == '|' && !marks)
+		{
+			if (parsing)
 			{
-				// Create a new token for the argument
-				Token *new = calloc(1, sizeof(Token));
-				if (new == NULL)
-				{
-					printf("Error: parse_input(): 'new' token creation failed\n");
-					return NULL;
-				}
-				strcpy(new->argument, buffer);
-
-				// Go at the end of the linked list
-				Token *current = head;
-				while (current->next != NULL)
-				{
-					current = current->next;
-				}
-
-				// Link the new token to the chain
-				current->next = new;		
+				*write++ = '\0';
+				parsing = false;
+			}
+			if (!reserve_args(args, args->argc + 2))
+			{
+				return false;
 			}
-			memset(buffer, 0, SIZE_INPUT);
-			index_buffer = 0;
+			args->argv[args->argc++] = NULL;
+			args->pipes++;
+			continue;
 		}
-		// Enter a double quotation mark input
-		else if (ptr[i] == '"' && !marks)
+
+		// Any other character starts an argument, even a quotation mark
+		if (!parsing)
 		{
-			marks = true;
+			// Keep one slot free for the NULL terminator
+			if (!reserve_args(args, args->argc + 2))
+			{
+				return false;
+			}
+			args->argv[args->argc++] = write;
+			parsing = true;
 		}
-		// Exit a double quotation mark input
-		else if (ptr[i] == '"' && marks)
+
+		if (*read == '"')
 		{
-			marks = false;
+			marks = !marks;
 		}
 		else
 		{
-			// Ignore spaces except if within double quotation marks
-			if (ptr[i] != ' ' || marks)
-			{
-				buffer[index_buffer] = ptr[i];
-				index_buffer++;
-				parsing = false;
-			}
+			*write++ = *read;
 		}
 	}
-	free(buffer);
-	return head;
+	if (parsing)
+	{
+		*write = '\0';
+	}
+
+	// An empty command line still needs room for the terminator
+	if (!reserve_args(args, 1))
+	{
+		return false;
+	}
+	args->argv[args->argc] = NULL;
+	return true;
 }
 
 
-int get_argc(Token *head)
+void *arena_alloc(Arena *arena, size_t size)
 {
-	int argc = 0;
-	while (head != NULL)
+	// Keep every allocation aligned for any type
+	size = (size + 15) & ~(size_t) 15;
+
+	Block *block = arena->head;
+	if (block == NULL || block->used + size > block->size)
 	{
-		head = head->next;
-		argc++;
+		size_t block_size = block ? block->size * 2 : ARENA_BLOCK;
+		while (block_size < size)
+		{
+			block_size *= 2;
+		}
+		Block *new = malloc(sizeof(Block) + block_size);
+		if (new == NULL)
+		{
+			return NULL;
+		}
+		arena->mallocs++;
+		new->next = block;
+		new->size = block_size;
+		new->used = 0;
+		arena->head = block = new;
 	}
-	return argc;
+
+	void *ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
 }
 
 
-char *get_argv(Token *head, int index)
+void arena_reset(Arena *arena)
 {
-	for (int i = 0; i < index; i++)
+	Block *block = arena->head;
+	if (block == NULL)
+	{
+		return;
+	}
+	if (block->next == NULL)
 	{
-		if (head->next == NULL)
+		block->used = 0;
+		return;
+	}
+
+	// Replace the chain of blocks with a single one of the same capacity
+	size_t total = 0;
+	while (block != NULL)
+	{
+		Block *next = block->next;
+		total += block->size;
+		free(block);
+		arena->frees++;
+		block = next;
+	}
+	arena->head = NULL;
+	Block *new = malloc(sizeof(Block) + total);
+	if (new == NULL)
+	{
+		return;
+	}
+	arena->mallocs++;
+	new->next = NULL;
+	new->size = total;
+	new->used = 0;
+	arena->head = new;
+}
+
+
+void arena_free(Arena *arena)
+{
+	while (arena->head != NULL)
+	{
+		Block *next = arena->head->next;
+		free(arena->head);
+		arena->frees++;
+		arena->head = next;
+	}
+}
+
+
+bool cwd_init(void)
+{
+	int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		return false;
+	}
+	if (getcwd(cwd.path, sizeof(cwd.path)) == NULL)
+	{
+		close(fd);
+		return false;
+	}
+	cwd.fd = fd;
+	return true;
+}
+
+
+bool change_directory(const char *path)
+{
+	int fd = openat(cwd.fd, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		return false;
+	}
+	if (fchdir(fd) == -1)
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return false;
+	}
+
+	// The path is only resolved once here, so that pwd has nothing to do
+	char canonical[PATH_MAX];
+	if (getcwd(canonical, sizeof(canonical)) != NULL)
+	{
+		memcpy(cwd.path, canonical, strlen(canonical) + 1);
+	}
+	else if (path[0] == '/')
+	{
+		snprintf(cwd.path, sizeof(cwd.path), "%s", path);
+	}
+	else
+	{
+		// Too long to be resolved: keep the path it was reached through
+		size_t length = strlen(cwd.path), added = strlen(path);
+		if (length + 1 + added < sizeof(cwd.path))
 		{
-			printf("Error: get_argv(): index out of range\n");
-			return 0;
+			cwd.path[length] = '/';
+			memcpy(cwd.path + length + 1, path, added + 1);
 		}
-		head = head->next;
 	}
-	// Return the n-th argument
-	return head->argument;
+	if (cwd.fd != AT_FDCWD)
+	{
+		close(cwd.fd);
+	}
+	cwd.fd = fd;
+	return true;
+}
+
+
+double get_time(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec + time.tv_nsec / 1e9;
 }
 
 
-void free_tokens(Token *head)
+/**
+ * Write all of @p size bytes, even if the file descriptor accepts
+ * less at once.
+*/
+static bool write_all(int fd, const char *data, size_t size)
 {
-	// Go to the tail
-	if (head->next != NULL)
+	while (size > 0)
 	{
-		free_tokens(head->next);
+		ssize_t bytes = write(fd, data, size);
+		if (bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		data += bytes;
+		size -= bytes;
 	}
-	free(head);
+	return true;
+}
+
+
+FILE *command_output(void)
+{
+	return streams.out != NULL ? streams.out : stdout;
+}
+
+
+bool transfer_data(int in, int out)
+{
+	struct stat buf;
+	bool pipe_out = fstat(out, &buf) == 0 && S_ISFIFO(buf.st_mode);
+	bool pipe_in = fstat(in, &buf) == 0 && S_ISFIFO(buf.st_mode);
+
+	/**
+	 * Let the kernel move the data without copying it to user space.
+	 * If the first call is refused, the files do not support it and
+	 * the buffered copy is used instead.
+	*/
+	bool first = true;
+	while (true)
+	{
+		ssize_t bytes = pipe_out || pipe_in
+			? splice(in, NULL, out, NULL, SIZE_TRANSFER, SPLICE_F_MORE)
+			: sendfile(out, in, NULL, SIZE_TRANSFER);
+		if (bytes == 0)
+		{
+			return true;
+		}
+		if (bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (first && (errno == EINVAL || errno == ENOSYS))
+			{
+				break;
+			}
+			return false;
+		}
+		first = false;
+	}
+
+	// Each call has its own buffer, as builtins may run on several threads
+	char *buffer = aligned_alloc(4096, SIZE_TRANSFER);
+	if (buffer == NULL)
+	{
+		return false;
+	}
+	bool success = true;
+	while (true)
+	{
+		ssize_t bytes = read(in, buffer, SIZE_TRANSFER);
+		if (bytes == 0)
+		{
+			break;
+		}
+		if (bytes == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			success = false;
+			break;
+		}
+		if (!write_all(out, buffer, bytes))
+		{
+			success = false;
+			break;
+		}
+	}
+	int error = errno;
+	free(buffer);
+	errno = error;
+	return success;
 }
 
 
@@ -219,7 +544,7 @@ bool is_option(const char *arg)
 {
 	if (arg == NULL)
 	{
-		printf("Error: is_option(): Null pointer\n");
+		fprintf(command_output(), "Error: is_option(): Null pointer\n");
 		return false;
 	}
 
@@ -231,56 +556,68 @@ bool is_option(const char *arg)
 }
 
 
-void recursive_deletion(const char *path)
+bool take_value(int *argc, char **argv, const char *option, char **value)
 {
-	DIR *dir = opendir(path);
-	if (dir == NULL)
+	for (int i = 1; i < *argc; i++)
 	{
-		printf("Error: Cannot open directory: %s\n", path);
-		return;
+		if (strcmp(argv[i], option))
+		{
+			continue;
+		}
+		if (i + 1 >= *argc)
+		{
+			fprintf(command_output(), "Error: '%s': Missing value\n", option);
+			return false;
+		}
+		*value = argv[i + 1];
+
+		// Shift the following arguments, the NULL terminator included
+		memmove(&argv[i], &argv[i + 2], (*argc - i - 1) * sizeof(char *));
+		*argc -= 2;
+		return true;
 	}
+	return true;
+}
+
 
-	struct dirent *entry = readdir(dir);
-	if (entry == NULL)
+// Unlink the files of a directory as they are read
+static bool removal_visit(Walker *walker, Walk_dir *dir, const char *name, unsigned char type)
+{
+	if (type != DT_DIR && unlinkat(dir->fd, name, 0) == -1)
 	{
-		printf("Error: Cannot read directory\n");
-		return;
+		walk_error(walker, dir, name);
 	}
+	return true;
+}
 
-	// For each element of the top folder
-	struct stat buf;
-	while (entry != NULL)
-	{
-		/* Concatenate the path with the file name to have the full path of the file/folder */ 
-		char new_path[PATH_MAX];
-		snprintf(new_path, PATH_MAX, "%s/%s", path, entry->d_name);
-		stat(new_path, &buf);
-		// If the element is a directory, except the system-specific directories '.' and '..'
-		if (S_ISDIR(buf.st_mode)
-			&& strcmp(entry->d_name, ".")
-			&& strcmp(entry->d_name, ".."))
-		{
-			// Delete by recursion
-			recursive_deletion(new_path);
-		}
-		else if (!S_ISDIR(buf.st_mode))
-		{
-			if (unlink(new_path) == -1)
-			{
-				fprintf(stderr, "Error: Failed to remove '%s': ", entry->d_name);
-				perror("");
-				return;
-			}
-		}
-		// Go to next element
-		entry = readdir(dir);
-    }
+// Remove a directory once its content is gone
+static void removal_leave(Walker *walker, Walk_dir *dir)
+{
+	int parent_fd = dir->parent ? dir->parent->fd : walker->root_fd;
+	if (unlinkat(parent_fd, dir->name, AT_REMOVEDIR) == -1)
+	{
+		walk_error(walker, dir, NULL);
+	}
+}
 
-	// Finally, delete the top directory
-	closedir(dir);
-	if (rmdir(path) == -1)
+
+bool remove_tree(int dirfd, const char *path, int threads)
+{
+	// Anything but a directory is unlinked right away
+	if (unlinkat(dirfd, path, 0) == 0)
 	{
-		perror("");
-		return;
+		return true;
 	}
-}
\ No newline at end of file
+	if (errno != EISDIR)
+	{
+		fprintf(stderr, "Error: Failed to remove '%s': %m\n", path);
+		return false;
+	}
+
+	Walker walker = {
+		.threads = threads,
+		.visit = removal_visit,
+		.leave = removal_leave,
+	};
+	return walk(&walker, dirfd, path);
+}
@@ -5,109 +5,295 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 
-// Maximum number of characters allowed for a single command line 
-#define SIZE_INPUT 100
+// Initial size of an input buffer, grown as longer lines come in
+#define SIZE_INPUT 4096
 #define PATH_MAX 4096
+// Size of the first memory block of an arena, in bytes
+#define ARENA_BLOCK 4096
+// Number of bytes moved at once by transfer_data()
+#define SIZE_TRANSFER (128 * 1024)
 
 /**
- * @brief @struct type to store parsed arguments within a linked list.
+ * @brief @struct type to store the parsed arguments of a command line.
  * 
- * Each argument of a command line is parsed from the input and
- * stored in a token. The tokens are linked to each other using
- * a pointer referencing the next token.
+ * Each argument is a slice of the input buffer: the parser terminates
+ * it in place instead of copying it. The slices are gathered in a
+ * contiguous array, terminated by a NULL pointer, which gives direct
+ * access to the n-th argument. The array lives in the memory of the
+ * current command line. The commands of a pipeline are separated by
+ * a NULL pointer as well, @p pipes counting the separators. A line
+ * ending with '&' is run in the background.
 */
-typedef struct token
+typedef struct args
 {
-	char argument[SIZE_INPUT];
-	struct token *next;
-} Token;
+	int argc;
+	char **argv;
+	int capacity;
+	int pipes;
+	bool background;
+} Args;
 
 
 /**
- * bool get_input(char *ptr)
- * @brief Retrieve data from the buffer and stores it in a string.
+ * @brief @struct type for a buffered line reader.
  * 
- * @param[out] ptr	Memory area to store the data to.
- * @return			A boolean stating the outcome of the function.
- * @retval			true on success.
- * 					false on failure.
+ * Data is read from the file descriptor in large chunks and lines
+ * are returned from the buffer. The buffer grows when a line does
+ * not fit, so that there is no limit on the length of a line.
+*/
+typedef struct reader
+{
+	int fd;
+	char *buffer;
+	size_t size;
+	size_t start;
+	size_t end;
+	bool eof;
+} Reader;
+
+// Reader of the standard input
+extern Reader stdin_reader;
+
+
+/**
+ * @brief @struct type for a memory block owned by an arena.
+*/
+typedef struct block
+{
+	struct block *next;
+	size_t size;
+	size_t used;
+	char data[];
+} Block;
+
+/**
+ * @brief @struct type for a bump allocator.
+ * 
+ * Memory is handed out by moving a cursor forward in the current
+ * block, and is only given back all at once by arena_reset(). The
+ * number of calls to malloc() and free() made by the arena itself
+ * are counted, so that its steady state can be checked. They do not
+ * include the allocations of the commands outside of the arena, such
+ * as their buffers, walks and caches.
+*/
+typedef struct arena
+{
+	Block *head;
+	size_t mallocs;
+	size_t frees;
+} Arena;
+
+/**
+ * Scratch memory of the current command line, reset by the main loop.
+ * The builtins of a pipeline run on threads, each with its own.
+*/
+extern __thread Arena line_arena;
+
+
+/**
+ * @brief @struct type for the standard streams of a builtin command.
  * 
- * The function 'get_input()' accepts a pointer @p ptr as input
- * and returns an integer indicating success or failure. If the
- * input command is too long, the function will print an error
- * message and return false.
+ * The builtins of a pipeline read from and write to pipes instead of
+ * the standard input and output of the shell. Each thread has its own
+ * streams: @p in is the standard input and @p out the standard output
+ * unless they are set.
 */
-bool get_input(char *ptr);
+typedef struct streams
+{
+	int in;
+	FILE *out;
+} Streams;
+
+// Streams of the builtin running on the current thread
+extern __thread Streams streams;
 
 
 /**
- * Token *parse_input(char *ptr)
+ * @brief @struct type for the working directory of the shell.
+ * 
+ * The directory is kept open, so that the builtins resolve relative
+ * paths from @p fd with the *at() system calls instead of walking the
+ * full path again. @p path is its canonical path, only computed when
+ * the directory changes. The working directory of the process follows
+ * it, for the programs launched from the shell.
+*/
+typedef struct cwd
+{
+	int fd;
+	char path[PATH_MAX];
+} Cwd;
+
+// Working directory, AT_FDCWD until cwd_init() is called
+extern Cwd cwd;
+
+
+/**
+ * bool get_input(Reader *reader, char **line)
+ * @brief Retrieve the next line from a reader.
+ * 
+ * @param[in] reader	Reader to get the line from.
+ * @param[out] line		Pointer set to the line.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false at the end of the input or on failure.
+ * 
+ * The function get_input() accepts a pointer @p reader and a pointer
+ * @p line as input. It sets @p line to the next line of the input,
+ * without its newline character and leading or trailing whitespaces.
+ * The line is null-terminated and lives in the buffer of @p reader ,
+ * where it can be modified. It stays valid until the next call on
+ * the same reader. A last line without newline character is returned
+ * as well before the end of the input is reported.
+*/
+bool get_input(Reader *reader, char **line);
+
+
+/**
+ * bool parse_input(char *ptr, Args *args)
  * @brief Parse all arguments from the input using spaces as delimiters.
  * 
- * @param[in] ptr	Memory area with the data to be parsed.
- * @return			A pointer to the head of a linked list.
- * @retval			'Token' pointer on success.
- * 					NULL pointer on failure.
+ * @param[in,out] ptr	Memory area with the data to be parsed.
+ * @param[out] args		Argument array to fill.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false on failure.
  * 
- * The function parse_input() accepts a pointer @p ptr as input and
- * returns a pointer of type `Token` if successful, NULL if not. The
- * purpose of the function is to parse the command line given as
- * argument, using spaces as delimiters. One exception is the presence
- * of double quotation marks, enabling the use of spaces within an
- * argument. To do so, @p marks is set to 1 when a double quotation
- * marks is found, and set back to 0 when the second one is reached.
- * During the parsing process, the function creates a linked list and
- * stores each argument in an individual `Token` variable.
+ * The function parse_input() accepts a pointer @p ptr and a pointer
+ * @p args as input. It splits the command line given as argument in
+ * a single pass, using spaces as delimiters. One exception is the
+ * presence of double quotation marks, enabling the use of spaces
+ * within an argument. To do so, @p marks is set to true when a double
+ * quotation mark is found, and set back to false when the second one
+ * is reached. The quotation marks are removed and each argument is
+ * terminated in place, so that the entries of @p args point directly
+ * into @p ptr . The array itself is allocated from 'line_arena'.
+ * A vertical bar outside of quotation marks separates two commands
+ * of a pipeline, and an ampersand outside of them ends the line.
 */
-Token *parse_input(char *ptr);
+bool parse_input(char *ptr, Args *args);
 
 
 /**
- * int get_argc(Token *head)
- * @brief Get the number of arguments for the given command line.
+ * void *arena_alloc(Arena *arena, size_t size)
+ * @brief Allocate memory from an arena.
  * 
- * @param[in] head	Memory area where the parsed data is.
- * @return			Number of arguments.
+ * @param[in] arena	Arena to allocate from.
+ * @param[in] size	Number of bytes to allocate.
+ * @return			A pointer to the allocated memory.
+ * @retval			Pointer to the memory area on success.
+ * 					NULL pointer on failure.
  * 
- * The function get_argc() accepts a pointer @p head as input and
- * returns the number of arguments of the parsed command line. To do
- * so, it counts the number of non-null tokens within the linked
- * list.
+ * The function arena_alloc() accepts a pointer @p arena and a
+ * size @p size as input. It returns a memory area of @p size bytes,
+ * aligned for any type. A new block is only requested from the
+ * system when the current one is full. The memory is not
+ * initialized.
 */
-int get_argc(Token *head);
+void *arena_alloc(Arena *arena, size_t size);
 
 
 /**
- * char *get_argv(Token *head, int index)
- * @brief Get the value of the n-th arguments.
+ * void arena_reset(Arena *arena)
+ * @brief Release all the memory allocated from an arena.
  * 
- * @param[in] head	Memory area where the parsed data is.
- * @param[in] index	Index of the argument.
- * @return			Character pointer of the n-th argument.
+ * @param[in] arena	Arena to reset.
+ * @return			Nothing.
  * 
- * The function get_argv() accepts a pointer @p head as input and
- * returns the character pointer from the token of index @p n .
- * To do so, it moves through the linked list by @p n increments,
- * starting from the head.
+ * The function arena_reset() accepts a pointer @p arena as input.
+ * It makes all of its memory available again. If the arena had to
+ * grow since the last reset, its blocks are merged into a single
+ * one large enough for the same usage, so that the next cycles do
+ * not have to allocate any block for the same usage.
 */
-char *get_argv(Token *head, int index);
+void arena_reset(Arena *arena);
 
 
 /**
- * void free_tokens(Token *head)
- * @brief Free the allocated memory of the linked list.
+ * void arena_free(Arena *arena)
+ * @brief Give the memory of an arena back to the system.
  * 
- * @param[in] head	Memory area where the parsed data is.
+ * @param[in] arena	Arena to free.
  * @return			Nothing.
+*/
+void arena_free(Arena *arena);
+
+
+/**
+ * bool cwd_init(void)
+ * @brief Open the working directory of the process.
+ * 
+ * @return			A boolean stating the outcome of the function.
+ * @retval			true on success.
+ * 					false on failure.
  * 
- * The function free_tokens() accepts a pointer @p head as input. 
- * It frees all previously allocated memory used by the linked list
- * by going to the end of the list, and recursively freeing each
- * token as it goes back to the head.
+ * The function cwd_init() opens the working directory the process
+ * was started in, and gets its canonical path. On failure, 'cwd'
+ * keeps resolving paths from the working directory of the process.
 */
-void free_tokens(Token *head);
+bool cwd_init(void);
+
+
+/**
+ * bool change_directory(const char *path)
+ * @brief Change the working directory of the shell.
+ * 
+ * @param[in] path	Absolute path, or path relative to 'cwd'.
+ * @return			A boolean stating the outcome of the function.
+ * @retval			true on success.
+ * 					false on failure, 'cwd' being left unchanged.
+ * 
+ * The function change_directory() accepts a character pointer
+ * @p path as input. It opens the directory relative to 'cwd', moves
+ * the process into it with fchdir(), and updates the file descriptor
+ * and the canonical path of 'cwd'. On failure, 'errno' is set.
+*/
+bool change_directory(const char *path);
+
+
+/**
+ * double get_time(void)
+ * @brief Get the time of a monotonic clock.
+ * 
+ * @return			Time in seconds.
+ * 
+ * The function get_time() returns the current time of a monotonic
+ * clock, to be used for measuring durations.
+*/
+double get_time(void);
+
+
+/**
+ * FILE *command_output(void)
+ * @brief Get the standard output of the builtin being run.
+ * 
+ * @return			Stream to write the output of the builtin to.
+*/
+FILE *command_output(void);
+
+
+/**
+ * bool transfer_data(int in, int out)
+ * @brief Copy all the data of a file descriptor to another one.
+ * 
+ * @param[in] in	File descriptor to read from.
+ * @param[in] out	File descriptor to write to.
+ * @return			A boolean stating the outcome of the function.
+ * @retval			true on success.
+ * 					false on failure.
+ * 
+ * The function transfer_data() accepts two file descriptors @p in
+ * and @p out as input. It copies the data from @p in to @p out until
+ * the end of @p in is reached. The data is moved by the kernel with
+ * splice() when @p in or @p out is a pipe, or with sendfile()
+ * otherwise. When neither can be used for the given files, the data
+ * goes through a large aligned buffer instead. The function can be
+ * called from several threads at once.
+*/
+bool transfer_data(int in, int out);
 
 
 /**
@@ -127,19 +313,47 @@ bool is_option(const char *arg);
 
 
 /**
- * void recursive_deletion(char *path)
+ * bool take_value(int *argc, char **argv, const char *option, char **value)
+ * @brief Remove an option taking a value from the arguments.
+ * 
+ * @param[in,out] argc	Number of arguments.
+ * @param[in,out] argv	Array of arguments.
+ * @param[in] option	Option to look for, such as "-j".
+ * @param[out] value	Value of the option, left unchanged if absent.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if the option is not followed by a value.
+ * 
+ * The function take_value() looks for @p option in @p argv . If
+ * found, @p value is set to the argument following it, and both
+ * arguments are removed from @p argv , so that the command only
+ * sees its other options and operands.
+*/
+bool take_value(int *argc, char **argv, const char *option, char **value);
+
+
+/**
+ * bool remove_tree(int dirfd, const char *path, int threads)
  * @brief Delete the folder given in path, as well as all of its
  * content.
  * 
- * @param[in] path	Path to the folder to remove.
- * @return			Nothing.
+ * @param[in] dirfd		Directory @p path is relative to.
+ * @param[in] path		Path to the folder to remove.
+ * @param[in] threads	Number of threads deleting the content.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if anything could not be removed.
  * 
- * The function recursive_deletion() accepts a character pointer
- * @p path as input. It recursively deletes a folder and all of
- * its content. The function does not have any confirmation prompt 
- * mechanism. Use carefully.
+ * The function remove_tree() accepts a file descriptor @p dirfd ,
+ * a character pointer @p path and an integer @p threads as input.
+ * It deletes a folder and all of its content with a parallel walk:
+ * independent subtrees are deleted by different threads, every file
+ * being unlinked relative to its directory, and each folder is
+ * removed once its content is gone. A file given as @p path is
+ * simply unlinked. The function does not have any confirmation
+ * prompt mechanism. Use carefully.
 */
-void recursive_deletion(const char *path);
+bool remove_tree(int dirfd, const char *path, int threads);
 
 
 #endif // UTILS_H
\ No newline at end of file
@@ -0,0 +1,463 @@
+// Parallel directory walker definitions
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include "walker.h"
+#include "utils.h"
+
+
+/**
+ * @brief @struct type for the arguments of a thread of the walk.
+*/
+typedef struct worker
+{
+	Walker *walker;
+	int self;
+} Worker;
+
+
+int default_threads(void)
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int) count : 1;
+}
+
+
+void walk_error(Walker *walker, Walk_dir *dir, const char *name)
+{
+	// A single call, so that messages of different threads do not mix
+	if (name == NULL)
+	{
+		fprintf(stderr, "Error: '%s': %m\n", dir->path);
+	}
+	else
+	{
+		fprintf(stderr, "Error: '%s/%s': %m\n", dir->path, name);
+	}
+	walker->failed = true;
+}
+
+
+/**
+ * Soft limit of open files before the first of the walks running,
+ * restored once the last of them ends if it was raised.
+*/
+static pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rlimit saved_limit;
+static bool limit_raised = false;
+static int limit_users = 0;
+
+
+// Deep trees keep many directories open, up to the hard limit during a walk
+static void raise_limit(void)
+{
+	pthread_mutex_lock(&limit_lock);
+	if (limit_users++ == 0 && getrlimit(RLIMIT_NOFILE, &saved_limit) == 0
+		&& saved_limit.rlim_cur < saved_limit.rlim_max)
+	{
+		struct rlimit limit = {saved_limit.rlim_max, saved_limit.rlim_max};
+		limit_raised = setrlimit(RLIMIT_NOFILE, &limit) == 0;
+	}
+	pthread_mutex_unlock(&limit_lock);
+}
+
+
+// Give the programs run afterwards the soft limit they would have had
+static void restore_limit(void)
+{
+	pthread_mutex_lock(&limit_lock);
+	if (--limit_users == 0 && limit_raised)
+	{
+		setrlimit(RLIMIT_NOFILE, &saved_limit);
+		limit_raised = false;
+	}
+	pthread_mutex_unlock(&limit_lock);
+}
+
+
+// Create the node of a directory, its path being built once from its parent's
+static Walk_dir *new_dir(Walk_dir *parent, const char *name)
+{
+	size_t length = strlen(name);
+	Walk_dir *dir = malloc(sizeof(Walk_dir) + length + 1);
+	if (dir == NULL)
+	{
+		return NULL;
+	}
+	memcpy(dir->name, name, length + 1);
+
+	if (parent == NULL)
+	{
+		dir->path = strdup(name);
+	}
+	else
+	{
+		size_t parent_length = strlen(parent->path);
+		bool slash = parent_length > 0 && parent->path[parent_length - 1] == '/';
+		dir->path = malloc(parent_length + !slash + length + 1);
+		if (dir->path != NULL)
+		{
+			memcpy(dir->path, parent->path, parent_length);
+			if (!slash)
+			{
+				dir->path[parent_length++] = '/';
+			}
+			memcpy(dir->path + parent_length, name, length + 1);
+		}
+	}
+	if (dir->path == NULL)
+	{
+		free(dir);
+		return NULL;
+	}
+
+	dir->parent = parent;
+	dir->fd = -1;
+	dir->depth = parent ? parent->depth + 1 : 0;
+	dir->data = NULL;
+	dir->pending = 1;
+	dir->entered = false;
+	dir->stream = NULL;
+	return dir;
+}
+
+
+static bool deque_push(Deque *deque, Walk_dir *dir)
+{
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count == deque->size)
+	{
+		// Grow the ring, its items being moved back to the start
+		size_t size = deque->size ? deque->size * 2 : 64;
+		Walk_dir **items = malloc(size * sizeof(Walk_dir *));
+		if (items == NULL)
+		{
+			pthread_mutex_unlock(&deque->lock);
+			return false;
+		}
+		for (size_t i = 0; i < deque->count; i++)
+		{
+			items[i] = deque->items[(deque->head + i) % deque->size];
+		}
+		free(deque->items);
+		deque->items = items;
+		deque->size = size;
+		deque->head = 0;
+	}
+	deque->items[(deque->head + deque->count) % deque->size] = dir;
+	deque->count++;
+	pthread_mutex_unlock(&deque->lock);
+	return true;
+}
+
+
+// Take the most recent directory, for the owner of the queue
+static Walk_dir *deque_pop(Deque *deque)
+{
+	Walk_dir *dir = NULL;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0)
+	{
+		deque->count--;
+		dir = deque->items[(deque->head + deque->count) % deque->size];
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return dir;
+}
+
+
+// Take the oldest directory, for the other threads
+static Walk_dir *deque_steal(Deque *deque)
+{
+	Walk_dir *dir = NULL;
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0)
+	{
+		dir = deque->items[deque->head];
+		deque->head = (deque->head + 1) % deque->size;
+		deque->count--;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return dir;
+}
+
+
+// Wake up an idle thread, or all of them when the walk is over
+static void notify(Walker *walker, bool all)
+{
+	pthread_mutex_lock(&walker->lock);
+	walker->generation++;
+	if (walker->idle > 0)
+	{
+		if (all)
+		{
+			pthread_cond_broadcast(&walker->wakeup);
+		}
+		else
+		{
+			pthread_cond_signal(&walker->wakeup);
+		}
+	}
+	pthread_mutex_unlock(&walker->lock);
+}
+
+
+static bool schedule(Walker *walker, int self, Walk_dir *dir)
+{
+	walker->outstanding++;
+	if (!deque_push(&walker->deques[self], dir))
+	{
+		walker->outstanding--;
+		return false;
+	}
+	if (walker->threads > 1)
+	{
+		notify(walker, false);
+	}
+	return true;
+}
+
+
+/**
+ * Get the next directory to work on: from the own queue first, then
+ * from the others. Returns NULL once no directory is left anywhere.
+*/
+static Walk_dir *take(Walker *walker, int self)
+{
+	while (true)
+	{
+		pthread_mutex_lock(&walker->lock);
+		unsigned long seen = walker->generation;
+		pthread_mutex_unlock(&walker->lock);
+
+		Walk_dir *dir = deque_pop(&walker->deques[self]);
+		for (int i = 1; dir == NULL && i < walker->threads; i++)
+		{
+			dir = deque_steal(&walker->deques[(self + i) % walker->threads]);
+		}
+		if (dir != NULL)
+		{
+			return dir;
+		}
+
+		// Sleep until some work is scheduled, unless it already was
+		pthread_mutex_lock(&walker->lock);
+		if (walker->outstanding == 0)
+		{
+			pthread_mutex_unlock(&walker->lock);
+			return NULL;
+		}
+		if (walker->generation == seen)
+		{
+			walker->idle++;
+			pthread_cond_wait(&walker->wakeup, &walker->lock);
+			walker->idle--;
+		}
+		pthread_mutex_unlock(&walker->lock);
+	}
+}
+
+
+/**
+ * Drop the scan or a finished child of a directory. The last one to
+ * go leaves the directory, which may in turn finish its parent.
+*/
+static void release(Walker *walker, Walk_dir *dir)
+{
+	while (dir != NULL && atomic_fetch_sub(&dir->pending, 1) == 1)
+	{
+		if (dir->entered && walker->leave != NULL)
+		{
+			walker->leave(walker, dir);
+		}
+		if (dir->stream != NULL)
+		{
+			closedir(dir->stream);
+		}
+		Walk_dir *parent = dir->parent;
+		free(dir->path);
+		free(dir);
+		dir = parent;
+	}
+}
+
+
+// Open a directory, read all of its entries and schedule its subdirectories
+static void process(Walker *walker, int self, Walk_dir *dir)
+{
+	int parent_fd = dir->parent ? dir->parent->fd : walker->root_fd;
+	int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC | (dir->parent ? O_NOFOLLOW : 0);
+	dir->fd = openat(parent_fd, dir->name, flags);
+	if (dir->fd == -1)
+	{
+		walk_error(walker, dir, NULL);
+		release(walker, dir);
+		return;
+	}
+	dir->stream = fdopendir(dir->fd);
+	if (dir->stream == NULL)
+	{
+		walk_error(walker, dir, NULL);
+		close(dir->fd);
+		release(walker, dir);
+		return;
+	}
+	if (walker->enter != NULL && !walker->enter(walker, dir))
+	{
+		release(walker, dir);
+		return;
+	}
+	dir->entered = true;
+
+	struct dirent *entry;
+	while ((entry = readdir(dir->stream)) != NULL)
+	{
+		const char *name = entry->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+		{
+			continue;
+		}
+
+		// Some file systems do not give the type of the entries
+		unsigned char type = entry->d_type;
+		if (type == DT_UNKNOWN)
+		{
+			struct stat buf;
+			if (fstatat(dir->fd, name, &buf, AT_SYMLINK_NOFOLLOW) == 0)
+			{
+				type = IFTODT(buf.st_mode);
+			}
+		}
+
+		bool descend = walker->visit ? walker->visit(walker, dir, name, type) : true;
+		if (type == DT_DIR && descend)
+		{
+			Walk_dir *child = new_dir(dir, name);
+			if (child == NULL)
+			{
+				errno = ENOMEM;
+				walk_error(walker, dir, name);
+				continue;
+			}
+			dir->pending++;
+			if (!schedule(walker, self, child))
+			{
+				errno = ENOMEM;
+				walk_error(walker, dir, name);
+				dir->pending--;
+				free(child->path);
+				free(child);
+			}
+		}
+	}
+
+	if (walker->scanned != NULL)
+	{
+		walker->scanned(walker, dir);
+	}
+
+	// The directory stays open for its subdirectories to be opened from it
+	release(walker, dir);
+}
+
+
+static void *work(void *argument)
+{
+	Worker *worker = argument;
+	Walker *walker = worker->walker;
+
+	Walk_dir *dir;
+	while ((dir = take(walker, worker->self)) != NULL)
+	{
+		process(walker, worker->self, dir);
+		if (--walker->outstanding == 0)
+		{
+			notify(walker, true);
+		}
+	}
+	return NULL;
+}
+
+
+bool walk(Walker *walker, int dirfd, const char *path)
+{
+	if (walker->threads < 1)
+	{
+		walker->threads = 1;
+	}
+	int threads = walker->threads;
+
+	raise_limit();
+
+	walker->failed = false;
+	walker->root_fd = dirfd;
+	walker->outstanding = 0;
+	walker->generation = 0;
+	walker->idle = 0;
+	walker->deques = calloc(threads, sizeof(Deque));
+	Worker *workers = calloc(threads, sizeof(Worker));
+	pthread_t *ids = calloc(threads, sizeof(pthread_t));
+	Walk_dir *root = new_dir(NULL, path);
+	if (walker->deques == NULL || workers == NULL || ids == NULL || root == NULL)
+	{
+		fprintf(command_output(), "Error: walk(): Memory allocation failed\n");
+		free(walker->deques);
+		free(workers);
+		free(ids);
+		if (root != NULL)
+		{
+			free(root->path);
+			free(root);
+		}
+		restore_limit();
+		return false;
+	}
+	pthread_mutex_init(&walker->lock, NULL);
+	pthread_cond_init(&walker->wakeup, NULL);
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_mutex_init(&walker->deques[i].lock, NULL);
+		workers[i].walker = walker;
+		workers[i].self = i;
+	}
+	schedule(walker, 0, root);
+
+	// The calling thread is the first worker
+	bool *started = calloc(threads, sizeof(bool));
+	for (int i = 1; started != NULL && i < threads; i++)
+	{
+		started[i] = pthread_create(&ids[i], NULL, work, &workers[i]) == 0;
+	}
+	work(&workers[0]);
+	for (int i = 1; started != NULL && i < threads; i++)
+	{
+		if (started[i])
+		{
+			pthread_join(ids[i], NULL);
+		}
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_mutex_destroy(&walker->deques[i].lock);
+		free(walker->deques[i].items);
+	}
+	pthread_mutex_destroy(&walker->lock);
+	pthread_cond_destroy(&walker->wakeup);
+	free(walker->deques);
+	walker->deques = NULL;
+	free(started);
+	free(workers);
+	free(ids);
+	restore_limit();
+	return !walker->failed;
+}
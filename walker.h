@@ -0,0 +1,139 @@
+/**
+ * Parallel directory walker declarations
+ * Directory trees are walked by a pool of threads stealing work from
+ * each other, every directory being opened relative to its parent.
+*/
+#ifndef WALKER_H
+#define WALKER_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/dir.h>
+
+/**
+ * @brief @struct type for a directory met during a walk.
+ * 
+ * Each directory knows its parent, so that it can be reached through
+ * the file descriptor of the parent. @p fd is open from the moment the
+ * directory is entered until it is left. @p data is free for the
+ * callbacks to use.
+*/
+typedef struct walk_dir
+{
+	struct walk_dir *parent;
+	char *path;
+	int fd;
+	int depth;
+	void *data;
+	// Own scan plus children directories not left yet
+	atomic_int pending;
+	bool entered;
+	DIR *stream;
+	char name[];
+} Walk_dir;
+
+typedef struct walker Walker;
+
+/**
+ * @brief @struct type for the queue of directories of a thread.
+ * 
+ * The owner takes the most recent directory, which keeps the walk
+ * depth-first and the number of open directories low, while other
+ * threads steal the oldest one, the root of the largest subtree.
+*/
+typedef struct deque
+{
+	pthread_mutex_t lock;
+	Walk_dir **items;
+	size_t size;
+	size_t head;
+	size_t count;
+} Deque;
+
+/**
+ * @brief @struct type for a walk over a directory tree.
+ * 
+ * The callbacks, all optional, are called from the threads of the
+ * walk and must be thread-safe:
+ * 		enter():	The directory was opened. Returning false skips it.
+ * 		visit():	An entry, other than '.' and '..', was read. For a
+ * 					directory, returning true walks it as well. The type
+ * 					is the one of 'struct dirent', resolved when unknown.
+ * 		scanned():	All the entries of the directory were read.
+ * 		leave():	All the subdirectories of the directory were left.
+ * 					The file descriptor of the parent is still open.
+ * Directories stay open until left, so that their subdirectories can
+ * be opened relative to them.
+*/
+struct walker
+{
+	int threads;
+	bool (*enter)(Walker *walker, Walk_dir *dir);
+	bool (*visit)(Walker *walker, Walk_dir *dir, const char *name, unsigned char type);
+	void (*scanned)(Walker *walker, Walk_dir *dir);
+	void (*leave)(Walker *walker, Walk_dir *dir);
+	void *context;
+	atomic_bool failed;
+	// Scheduling state
+	int root_fd;
+	Deque *deques;
+	atomic_long outstanding;
+	pthread_mutex_t lock;
+	pthread_cond_t wakeup;
+	unsigned long generation;
+	int idle;
+};
+
+
+/**
+ * int default_threads(void)
+ * @brief Get the default number of threads of a walk.
+ * 
+ * @return			Number of online processors.
+*/
+int default_threads(void);
+
+
+/**
+ * bool walk(Walker *walker, int dirfd, const char *path)
+ * @brief Walk a directory tree with a pool of threads.
+ * 
+ * @param[in] walker	Walk to run, with its callbacks set.
+ * @param[in] dirfd		Directory @p path is relative to.
+ * @param[in] path		Root directory of the walk.
+ * @return				A boolean stating the outcome of the function.
+ * @retval				true on success.
+ * 						false if an error was met.
+ * 
+ * The function walk() accepts a pointer @p walker , a file
+ * descriptor @p dirfd and a character pointer @p path as input.
+ * It walks the tree rooted at @p path with @p walker->threads
+ * threads, the calling thread being one of them. Each thread works
+ * depth-first on its own queue of directories, and steals from the
+ * other queues when its own is empty. Subdirectories are opened with
+ * openat() relative to their parent, and the type of each entry comes
+ * from the directory stream whenever the file system provides it.
+ * The soft limit of open files is raised to the hard limit while
+ * walks run, and restored once the last of them ends. The function
+ * returns once every directory was left.
+*/
+bool walk(Walker *walker, int dirfd, const char *path);
+
+
+/**
+ * void walk_error(Walker *walker, Walk_dir *dir, const char *name)
+ * @brief Report an error met on an entry during a walk.
+ * 
+ * @param[in] walker	Walk the error was met in.
+ * @param[in] dir		Directory of the entry.
+ * @param[in] name		Name of the entry, NULL for @p dir itself.
+ * @return				Nothing.
+ * 
+ * The function walk_error() displays the path of the entry along with
+ * the description of 'errno' on stderr, and marks the walk as failed.
+*/
+void walk_error(Walker *walker, Walk_dir *dir, const char *name);
+
+
+#endif // WALKER_H